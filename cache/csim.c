@@ -4,35 +4,99 @@ AndrewId: jstellwa
 
 Csim is a cache simulator.
 
-There are 4 command line flags
--t: path to trace file
+There are 8 command line flags
+-t: path to trace file (standard input if it is - or missing)
 -s: number of set index bits
 -E: number of lines per set
 -b: number of block index bits
+-v: print how fast the trace was read to stderr
+-j: number of threads to simulate with (see below)
+-D: print the LRU miss ratio curve over associativity instead (see below)
+-r: replacement policy: lru (the default), fifo, lfu, random, plru, nru,
+    srrip or brrip. The policies are described with their code
 
-Each set is represented by a set_t struct, which stores the tags, dirty bits,
-and valid bits of all the data in that set. The set_t struct also keeps track of
-the last time each line was used.
+-s, -E, -b and -r also take comma separated lists, like -s 4,5,6 or
+-r lru,plru. If more than one configuration is given, csim sweeps: the trace
+is parsed once into memory, every combination of the values is simulated,
+spread across -j threads (default: one per processor), and a table with one
+row per configuration is printed instead of the summary.
 
-The entire cache is represented by the cache_t struct which stores an array of
-sets along with otherr metadata about the cache such as the number of block
+With one configuration and -j greater than 1, the sets are split among -j
+worker threads, set i going to worker i modulo -j, while the main thread
+parses. Accesses reach each worker in batches in trace order, so every set
+sees its accesses in the same order as in a serial run, and the workers'
+stats add up to exactly the serial results.
+
+With -D, csim finds the LRU stack distance of every access: the number of
+other blocks of its set used since the block was last used. An access hits
+in a cache with E lines per set exactly when its distance is below E, so a
+histogram of the distances gives hits, misses and evictions for every E at
+once. A row is printed for each value given to -E, or for each power of two
+up to the point where only cold misses are left if -E isn't given.
+
+Trace files are mapped into memory and scanned in place; standard input and
+other files that can't be mapped are read in large blocks. Lines may be of
+any length. Binary traces (see trace2bin.c) are recognized by their magic
+number and decoded instead of scanned.
+
+The state of all sets lives in one contiguous allocation. Each set takes
+setStride bytes: the tags of its lines, then the last time each line was used
+(or other per-line state of the replacement policy), then its valid and dirty
+bits packed into bitmasks, then any bits the replacement policy keeps for the
+whole set. A lookup touches one region of memory instead of four separate heap
+blocks. A set_t points into that region for one set.
+
+On processors with AVX2, sets are searched 8 lines at a time: on an
+eviction for the oldest use time in sets of 8 or more lines, and for the
+matching tag in sets of 256 or more, where that was measured to be faster.
+
+The entire cache is represented by the cache_t struct which stores the set
+state along with other metadata about the cache such as the number of block
 bits.
 
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "cachelab.h"
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+// The values given to -s, -E or -b, a comma separated list
+typedef struct {
+    int *values;
+    int count;
+} list_t;
 
 // A bundle of the command line arguments to easily be passed
+// setBits, associativity, blockBits and policy are the first value of each
+// list. Policies are given by their index in the policies table
 typedef struct {
     char *tracefile;
     int setBits;
     int associativity;
     int blockBits;
+    bool verbose;
+    list_t setList;
+    list_t assocList;
+    list_t blockList;
+    int threads;
+    bool distances;
+    list_t policyList;
+    int policy;
 } args_t;
 
 // Stores a single instruction, 1 line of a trace file
@@ -41,20 +105,32 @@ typedef struct {
     char operation;
 } instruction_t;
 
-// Represents 1 set within the cache
+// Points at the state of 1 set within the cache
 typedef struct {
-    // all arrays have size #lines = associativity
+    // tags and lastModified have size #lines = associativity
     long *tags;
-    bool *dirty;
-    bool *valid;
     // Array keeping track of last time each line was changed
     int *lastModified;
+    // Bit i of these is set if line i is valid or dirty
+    uint64_t *valid;
+    uint64_t *dirty;
+    // Bits kept by the replacement policy, if it needs any
+    uint64_t *policyBits;
 } set_t;
 
+// A replacement policy, defined with the policies below
+typedef struct policy policy_t;
+
 // Represents the entire cache
 typedef struct {
-    // Array of sets, where most relevant information is stored
-    set_t *sets;
+    // State of all sets, setStride bytes per set
+    char *lines;
+    size_t setStride;
+    // Number of 64 bit words in each valid and dirty bitmask
+    int maskWords;
+    // Replacement policy, and the words of bits it keeps for each set
+    const policy_t *policy;
+    int policyWords;
     // Stats and metadata
     int setBits;
     int associativity;
@@ -62,45 +138,125 @@ typedef struct {
     csim_stats_t stats;
 } cache_t;
 
+// Splits a comma separated list of numbers, like 1,2,4
+list_t readList(char *arg) {
+    list_t list = {NULL, 0};
+
+    for (char *p = arg; p != NULL; p = strchr(p, ',')) {
+        if (*p == ',')
+            p++;
+        list.values = realloc(list.values, (list.count + 1) * sizeof(int));
+        if (list.values == NULL) {
+            printf("Allocation falurre \n");
+            exit(1);
+        }
+        list.values[list.count++] = atoi(p);
+    }
+    return list;
+}
+
+// Defined with the policies below. Returns a policy's index by name, or -1
+int findPolicy(const char *name);
+
+// Splits a comma separated list of policy names, like lru,fifo, into their
+// indices in the policies table
+list_t readPolicies(char *arg) {
+    list_t list = {NULL, 0};
+
+    for (char *name = strtok(arg, ","); name != NULL;
+         name = strtok(NULL, ",")) {
+        int policy = findPolicy(name);
+        if (policy == -1) {
+            fprintf(stderr, "Unknown replacement policy: %s\n", name);
+            exit(1);
+        }
+        list.values = realloc(list.values, (list.count + 1) * sizeof(int));
+        if (list.values == NULL) {
+            printf("Allocation falurre \n");
+            exit(1);
+        }
+        list.values[list.count++] = policy;
+    }
+    if (list.count == 0) {
+        fprintf(stderr, "Expected a replacement policy\n");
+        exit(1);
+    }
+    return list;
+}
+
 args_t readArgs(int argc, char **argv) {
     char opt;
+    static int zero = 0;
 
-    args_t args;
-    while ((opt = getopt(argc, argv, "s:E:b:t:")) != -1) {
+    list_t none = {&zero, 1};
+    args_t args = {NULL, 0, 0, 0, false, none, none, none, 0, false, none, 0};
+    while ((opt = getopt(argc, argv, "s:E:b:t:vj:Dr:")) != -1) {
         switch (opt) {
         case 's':
-            args.setBits = atoi(optarg);
+            args.setList = readList(optarg);
             break;
         case 'E':
-            args.associativity = atoi(optarg);
+            args.assocList = readList(optarg);
             break;
         case 'b':
-            args.blockBits = atoi(optarg);
+            args.blockList = readList(optarg);
             break;
         case 't':
             args.tracefile = optarg;
             break;
+        case 'v':
+            args.verbose = true;
+            break;
+        case 'j':
+            args.threads = atoi(optarg);
+            break;
+        case 'D':
+            args.distances = true;
+            break;
+        case 'r':
+            args.policyList = readPolicies(optarg);
+            break;
         default:
             fprintf(stderr, "usage: ");
             exit(1);
         }
     }
+    args.setBits = args.setList.values[0];
+    args.associativity = args.assocList.values[0];
+    args.blockBits = args.blockList.values[0];
+    args.policy = args.policyList.values[0];
     return args;
 }
-// Converts the raw string from the trace file into an instruction struct
-instruction_t processLine(char *line) {
-
-    instruction_t instruction;
+// Value + 1 of each hex digit character, 0 for anything else
+static const signed char hexDigits[256] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,  ['5'] = 6,
+    ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10, ['a'] = 11, ['b'] = 12,
+    ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16, ['A'] = 11, ['B'] = 12,
+    ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16};
 
-    char *token;
+// Converts one line of the trace, from line up to end (the newline), into an
+// instruction struct. Anything after the address, such as the size, is
+// skipped. Returns false for blank lines
+bool processLine(const char *line, const char *end,
+                 instruction_t *instruction) {
+    const char *p = line;
+    unsigned long address = 0;
 
-    token = strtok(line, " ,");
-    instruction.operation = token[0];
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    if (p == end)
+        return false;
+    instruction->operation = *p++;
 
-    token = strtok(NULL, " ,");
-    instruction.address = strtol(token, NULL, 16);
-
-    return instruction;
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        p += 2;
+    for (; p < end && hexDigits[(unsigned char)*p] != 0; p++) {
+        address = (address << 4) | (hexDigits[(unsigned char)*p] - 1);
+    }
+    instruction->address = (long)address;
+    return true;
 }
 // gives the value of the set bits in the address
 unsigned long getSetNum(long address, int setBits, int blockBits) {
@@ -109,13 +265,44 @@ unsigned long getSetNum(long address, int setBits, int blockBits) {
     return set & mask;
 }
 
+// Bit operations on the valid and dirty bitmasks
+static inline bool testBit(const uint64_t *mask, int i) {
+    return (mask[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void setBit(uint64_t *mask, int i) {
+    mask[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static inline void clearBit(uint64_t *mask, int i) {
+    mask[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+// Finds the state of a set within the cache's contiguous allocation
+static inline set_t getSet(const cache_t *cache, unsigned long setNum) {
+    set_t set;
+    char *base = cache->lines + setNum * cache->setStride;
+    int lines = cache->associativity;
+
+    set.tags = (long *)base;
+    set.valid = (uint64_t *)(base + cache->setStride -
+                             (2 * cache->maskWords + cache->policyWords) *
+                                 sizeof(uint64_t));
+    set.dirty = set.valid + cache->maskWords;
+    set.policyBits = set.dirty + cache->maskWords;
+    set.lastModified = (int *)(base + lines * sizeof(long));
+    return set;
+}
+
 // Checks if there are any open spaces in a given set
 // If there is an opening it returns the index otherwise -1
 int getFreeSpace(set_t set, int associativity) {
 
-    for (int i = 0; i < associativity; i++) {
-        if (!set.valid[i])
-            return i;
+    for (int w = 0; w * 64 < associativity; w++) {
+        if (~set.valid[w] != 0) {
+            int i = w * 64 + __builtin_ctzll(~set.valid[w]);
+            return i < associativity ? i : -1;
+        }
     }
     return -1;
 }
@@ -132,6 +319,322 @@ int getLeastRecentlyUsed(int *lastModified, int associativity) {
     }
     return min;
 }
+// Finds the valid line of a set holding tag
+// returns the lines index, or -1 if there is none
+int findTag(set_t set, int associativity, long tag) {
+    for (int i = 0; i < associativity; i++) {
+        if (set.tags[i] == tag && testBit(set.valid, i))
+            return i;
+    }
+    return -1;
+}
+
+#ifdef __x86_64__
+// Set at startup if the processor has AVX2
+static bool useAvx2 = false;
+
+// Smallest sets searched with AVX2, as measured on long.trace and a
+// 1024x1024 transpose. The vector tag search wins on the transpose's
+// misses from 32 lines up, but loses on long.trace, where most accesses
+// hit early in the set, until 256. The oldest line is found faster with
+// vectors from 8 lines up on both
+#define AVX2_FIND_MIN_LINES 256
+#define AVX2_OLDEST_MIN_LINES 8
+
+// The valid bits of lines i to i + 7, which may straddle two words
+static inline unsigned validByte(const uint64_t *mask, int i) {
+    uint64_t bits = mask[i / 64] >> (i % 64);
+    if (i % 64 > 56)
+        bits |= mask[i / 64 + 1] << (64 - i % 64);
+    return (unsigned)bits & 0xff;
+}
+
+// findTag with AVX2, 8 lines at a time. The tags are compared 4 to a vector,
+// giving a mask of the matching lines that is anded with the valid bits.
+// Lines fill from index 0, so the longest resident blocks, often the hottest,
+// sit at the front: the first two are checked on their own before any
+// vector is touched, and the vectors start after them
+__attribute__((target("avx2"))) int findTagAvx2(set_t set, int associativity,
+                                                long tag) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (set.tags[i] == tag && testBit(set.valid, i))
+            return i;
+    }
+
+    // Every return from here on clears the upper halves of the vector
+    // registers, or the SSE code the compiler generates everywhere else
+    // slows down badly
+    const __m256i key = _mm256_set1_epi64x(tag);
+    for (; i + 8 <= associativity; i += 8) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(set.tags + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(set.tags + i + 4));
+        __m256i eqLo = _mm256_cmpeq_epi64(lo, key);
+        __m256i eqHi = _mm256_cmpeq_epi64(hi, key);
+        unsigned match = _mm256_movemask_pd(_mm256_castsi256_pd(eqLo)) |
+                         _mm256_movemask_pd(_mm256_castsi256_pd(eqHi)) << 4;
+
+        match &= validByte(set.valid, i);
+        if (match != 0) {
+            _mm256_zeroupper();
+            return i + __builtin_ctz(match);
+        }
+    }
+    _mm256_zeroupper();
+    for (; i < associativity; i++) {
+        if (set.tags[i] == tag && testBit(set.valid, i))
+            return i;
+    }
+    return -1;
+}
+
+// getLeastRecentlyUsed with AVX2: the oldest time is found 8 lines at a time,
+// then the first line holding it, so ties go the same way
+__attribute__((target("avx2"))) int
+getLeastRecentlyUsedAvx2(int *lastModified, int associativity) {
+    __m256i oldest = _mm256_set1_epi32(INT_MAX);
+    int i;
+
+    for (i = 0; i + 8 <= associativity; i += 8) {
+        oldest = _mm256_min_epi32(
+            oldest, _mm256_loadu_si256((const __m256i *)(lastModified + i)));
+    }
+    __m128i half = _mm_min_epi32(_mm256_castsi256_si128(oldest),
+                                 _mm256_extracti128_si256(oldest, 1));
+    half = _mm_min_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+    half = _mm_min_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+    int minTime = _mm_cvtsi128_si32(half);
+    for (int j = i; j < associativity; j++) {
+        if (lastModified[j] < minTime)
+            minTime = lastModified[j];
+    }
+
+    const __m256i key = _mm256_set1_epi32(minTime);
+    for (i = 0; i + 8 <= associativity; i += 8) {
+        __m256i times = _mm256_loadu_si256((const __m256i *)(lastModified + i));
+        unsigned match = _mm256_movemask_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(times, key)));
+        if (match != 0) {
+            _mm256_zeroupper();
+            return i + __builtin_ctz(match);
+        }
+    }
+    _mm256_zeroupper();
+    while (lastModified[i] != minTime)
+        i++;
+    return i;
+}
+#endif
+
+// Replacement policies. Each line of a set has an int of policy state in
+// lastModified, and a policy that needs more keeps a few words of bits per
+// set in policyBits:
+//
+// lru     evicts the line used longest ago. lastModified holds the last use
+// fifo    evicts the line filled longest ago. lastModified holds the fill
+// lfu     evicts the line used least often, the first one on a tie.
+//         lastModified holds the uses since the fill
+// random  evicts any line. policyBits holds the set's random number state
+// plru    tree pseudo-LRU: a binary tree over the lines, 1 bit per node in
+//         policyBits, points away from the most recent use. The victim is
+//         found by following it from the root
+// nru     not recently used: a bit per line in policyBits, set on use. The
+//         victim is the first line without it, and when every line has it
+//         the bits are cleared
+// srrip   static re-reference interval prediction: lastModified holds a
+//         prediction from 0 (soon) to 3 (distant). Fills predict 2, hits
+//         0, and the victim is the first line at 3, after aging every line
+//         until one is
+// brrip   bimodal RRIP: as srrip, but fills predict 3, and only 1 in 32
+//         predicts 2. policyBits holds the random number state
+struct policy {
+    const char *name;
+    // Update the policy state of a line that was hit, or was just filled
+    // with a new block. NULL if a policy does nothing
+    void (*hit)(const cache_t *cache, set_t set, int line, int time);
+    void (*fill)(const cache_t *cache, set_t set, int line, int time);
+    // Picks the line to evict from a full set
+    int (*victim)(const cache_t *cache, set_t set);
+    // Words of policyBits needed per set, and how to set them up
+    int (*bitWords)(int associativity);
+    void (*seed)(uint64_t *policyBits, unsigned long setNum);
+};
+
+// The line of a set with the smallest value in lastModified
+int oldestLine(const cache_t *cache, set_t set) {
+#ifdef __x86_64__
+    if (useAvx2 && cache->associativity >= AVX2_OLDEST_MIN_LINES)
+        return getLeastRecentlyUsedAvx2(set.lastModified,
+                                        cache->associativity);
+#endif
+    return getLeastRecentlyUsed(set.lastModified, cache->associativity);
+}
+
+void recordTime(const cache_t *cache, set_t set, int line, int time) {
+    set.lastModified[line] = time;
+}
+
+void countUse(const cache_t *cache, set_t set, int line, int time) {
+    if (set.lastModified[line] < INT_MAX)
+        set.lastModified[line]++;
+}
+
+void fillCount(const cache_t *cache, set_t set, int line, int time) {
+    set.lastModified[line] = 1;
+}
+
+// Policies that need a random number keep one word of state per set, seeded
+// from the set number so that results don't depend on the order sets are
+// simulated in
+int oneWord(int associativity) {
+    return 1;
+}
+
+void seedRandom(uint64_t *policyBits, unsigned long setNum) {
+    policyBits[0] = (setNum + 1) * 0x9e3779b97f4a7c15UL;
+}
+
+// xorshift64
+uint64_t nextRandom(uint64_t *state) {
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+int randomLine(const cache_t *cache, set_t set) {
+    return nextRandom(set.policyBits) % cache->associativity;
+}
+
+// The tree of plru has a leaf for each line, rounded up to a power of two.
+// Node 1 is the root and node n has children 2n and 2n + 1. A set bit sends
+// the victim search right
+int treeLeaves(int associativity) {
+    int leaves = 1;
+
+    while (leaves < associativity)
+        leaves *= 2;
+    return leaves;
+}
+
+int treeWords(int associativity) {
+    return (treeLeaves(associativity) + 63) / 64;
+}
+
+void plruTouch(const cache_t *cache, set_t set, int line, int time) {
+    int node = 1;
+
+    for (int half = treeLeaves(cache->associativity) / 2; half > 0;
+         half /= 2) {
+        if (line & half) {
+            clearBit(set.policyBits, node);
+            node = 2 * node + 1;
+        } else {
+            setBit(set.policyBits, node);
+            node = 2 * node;
+        }
+    }
+}
+
+int plruVictim(const cache_t *cache, set_t set) {
+    int node = 1;
+    int line = 0;
+
+    for (int half = treeLeaves(cache->associativity) / 2; half > 0;
+         half /= 2) {
+        // Leaves past the last line don't exist, so never go there
+        if (testBit(set.policyBits, node) &&
+            line + half < cache->associativity) {
+            line += half;
+            node = 2 * node + 1;
+        } else {
+            node = 2 * node;
+        }
+    }
+    return line;
+}
+
+int lineWords(int associativity) {
+    return (associativity + 63) / 64;
+}
+
+void nruTouch(const cache_t *cache, set_t set, int line, int time) {
+    setBit(set.policyBits, line);
+}
+
+int nruVictim(const cache_t *cache, set_t set) {
+    int words = lineWords(cache->associativity);
+
+    for (int w = 0; w < words; w++) {
+        if (~set.policyBits[w] != 0) {
+            int i = w * 64 + __builtin_ctzll(~set.policyBits[w]);
+            if (i < cache->associativity)
+                return i;
+        }
+    }
+    memset(set.policyBits, 0, words * sizeof(uint64_t));
+    return 0;
+}
+
+// The largest re-reference prediction of rrip
+#define RRPV_MAX 3
+
+void rripHit(const cache_t *cache, set_t set, int line, int time) {
+    set.lastModified[line] = 0;
+}
+
+void srripFill(const cache_t *cache, set_t set, int line, int time) {
+    set.lastModified[line] = RRPV_MAX - 1;
+}
+
+void brripFill(const cache_t *cache, set_t set, int line, int time) {
+    bool near = nextRandom(set.policyBits) % 32 == 0;
+
+    set.lastModified[line] = near ? RRPV_MAX - 1 : RRPV_MAX;
+}
+
+int rripVictim(const cache_t *cache, set_t set) {
+    int victim = 0;
+
+    for (int i = 1; i < cache->associativity; i++) {
+        if (set.lastModified[i] > set.lastModified[victim])
+            victim = i;
+    }
+    // Age every line by as much as it takes the victim to reach RRPV_MAX
+    int age = RRPV_MAX - set.lastModified[victim];
+    if (age > 0) {
+        for (int i = 0; i < cache->associativity; i++)
+            set.lastModified[i] += age;
+    }
+    return victim;
+}
+
+// Selected by name with -r. The first is the default
+static const policy_t policies[] = {
+    {"lru", recordTime, recordTime, oldestLine, NULL, NULL},
+    {"fifo", NULL, recordTime, oldestLine, NULL, NULL},
+    {"lfu", countUse, fillCount, oldestLine, NULL, NULL},
+    {"random", NULL, NULL, randomLine, oneWord, seedRandom},
+    {"plru", plruTouch, plruTouch, plruVictim, treeWords, NULL},
+    {"nru", nruTouch, nruTouch, nruVictim, lineWords, NULL},
+    {"srrip", rripHit, srripFill, rripVictim, NULL, NULL},
+    {"brrip", rripHit, brripFill, rripVictim, oneWord, seedRandom},
+};
+
+#define NUM_POLICIES (int)(sizeof(policies) / sizeof(policies[0]))
+
+int findPolicy(const char *name) {
+    for (int i = 0; i < NUM_POLICIES; i++) {
+        if (strcmp(policies[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
 // Deals with the case where the tag was not found in the cache
 // Determines whether an eviction needs to be made and updates cache accordingly
 void handleMiss(set_t set, cache_t *cache, int time, bool isStore, long tag) {
@@ -141,30 +644,32 @@ void handleMiss(set_t set, cache_t *cache, int time, bool isStore, long tag) {
     cache->stats.misses++;
 
     if (freeSpace != -1) {
-        set.valid[freeSpace] = true;
+        setBit(set.valid, freeSpace);
         set.tags[freeSpace] = tag;
-        set.lastModified[freeSpace] = time;
-        set.dirty[freeSpace] = false;
+        if (cache->policy->fill != NULL)
+            cache->policy->fill(cache, set, freeSpace, time);
+        clearBit(set.dirty, freeSpace);
 
         if (isStore) {
-            set.dirty[freeSpace] = true;
+            setBit(set.dirty, freeSpace);
             cache->stats.dirty_bytes += (1 << cache->blockBits);
         }
     } else {
         cache->stats.evictions++;
 
-        int LRU = getLeastRecentlyUsed(set.lastModified, cache->associativity);
+        int victim = cache->policy->victim(cache, set);
 
-        set.lastModified[LRU] = time;
-        set.tags[LRU] = tag;
+        set.tags[victim] = tag;
+        if (cache->policy->fill != NULL)
+            cache->policy->fill(cache, set, victim, time);
 
-        if (set.dirty[LRU]) {
+        if (testBit(set.dirty, victim)) {
             cache->stats.dirty_evictions += (1 << cache->blockBits);
             cache->stats.dirty_bytes -= (1 << cache->blockBits);
-            set.dirty[LRU] = false;
+            clearBit(set.dirty, victim);
         }
         if (isStore) {
-            set.dirty[LRU] = true;
+            setBit(set.dirty, victim);
             cache->stats.dirty_bytes += (1 << cache->blockBits);
         }
     }
@@ -183,78 +688,465 @@ void executeInstruction(instruction_t instruction, cache_t *cache, int time) {
     long address = instruction.address;
     unsigned long setNum = getSetNum(address, cache->setBits, cache->blockBits);
     long tag = address >> (cache->setBits + cache->blockBits);
-    set_t set = cache->sets[setNum];
-
-    for (int i = 0; i < cache->associativity; i++) {
-        if (set.valid[i] && set.tags[i] == tag) {
-            cache->stats.hits++;
-            set.lastModified[i] = time;
-            if (isStore && !set.dirty[i]) {
-                cache->stats.dirty_bytes += (1 << cache->blockBits);
-                set.dirty[i] = true;
-            }
-            return;
+    set_t set = getSet(cache, setNum);
+
+    int i;
+#ifdef __x86_64__
+    if (useAvx2 && cache->associativity >= AVX2_FIND_MIN_LINES)
+        i = findTagAvx2(set, cache->associativity, tag);
+    else
+#endif
+        i = findTag(set, cache->associativity, tag);
+
+    if (i == -1) {
+        handleMiss(set, cache, time, isStore, tag);
+        return;
+    }
+    cache->stats.hits++;
+    if (cache->policy->hit != NULL)
+        cache->policy->hit(cache, set, i, time);
+    if (isStore && !testBit(set.dirty, i)) {
+        cache->stats.dirty_bytes += (1 << cache->blockBits);
+        setBit(set.dirty, i);
+    }
+}
+// Number of instructions handed to a worker at a time, and the most batches
+// a worker may have at once. The parser waits for a worker that falls this
+// far behind
+#define BATCH_SIZE 4096
+#define MAX_BATCHES 16
+
+// A run of instructions for one worker, all in sets it owns, in trace order
+typedef struct batch {
+    instruction_t items[BATCH_SIZE];
+    int count;
+    struct batch *next;
+} batch_t;
+
+// A thread simulating the sets whose number is its index modulo the number
+// of workers. Its cache shares the set state with every other worker but
+// keeps its own stats and time. Batches wait in the full queue, and come
+// back to the parser through the free list
+typedef struct {
+    pthread_t thread;
+    cache_t cache;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    batch_t *fullHead;
+    batch_t *fullTail;
+    batch_t *free;
+    batch_t *filling;
+    int allocated;
+    bool done;
+} worker_t;
+
+// Splits a trace across workers by set
+typedef struct {
+    worker_t *workers;
+    int numWorkers;
+    int setBits;
+    int blockBits;
+} engine_t;
+
+// Takes a batch to fill for worker, waiting if it has MAX_BATCHES already
+batch_t *takeBatch(worker_t *worker) {
+    batch_t *batch;
+
+    pthread_mutex_lock(&worker->lock);
+    while (worker->free == NULL && worker->allocated == MAX_BATCHES)
+        pthread_cond_wait(&worker->changed, &worker->lock);
+    if ((batch = worker->free) != NULL) {
+        worker->free = batch->next;
+    } else {
+        worker->allocated++;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    if (batch == NULL && (batch = malloc(sizeof(batch_t))) == NULL) {
+        printf("Allocation falurre \n");
+        exit(1);
+    }
+    batch->count = 0;
+    return batch;
+}
+
+// Queues the batch being filled for worker
+void submitBatch(worker_t *worker) {
+    batch_t *batch = worker->filling;
+
+    batch->next = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->fullTail != NULL)
+        worker->fullTail->next = batch;
+    else
+        worker->fullHead = batch;
+    worker->fullTail = batch;
+    pthread_cond_signal(&worker->changed);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+// Hands an instruction to the worker that owns its set
+static inline void routeInstruction(engine_t *engine,
+                                    instruction_t instruction) {
+    unsigned long setNum = getSetNum(instruction.address, engine->setBits,
+                                     engine->blockBits);
+    worker_t *worker = &engine->workers[setNum % engine->numWorkers];
+
+    worker->filling->items[worker->filling->count++] = instruction;
+    if (worker->filling->count == BATCH_SIZE) {
+        submitBatch(worker);
+        worker->filling = takeBatch(worker);
+    }
+}
+
+// Thread body of a worker: executes batches in the order they were queued
+// until the parser is done. Time only has to increase within each set, so
+// each worker counts its own
+void *engineWorker(void *arg) {
+    worker_t *worker = arg;
+    int time = 1;
+
+    pthread_mutex_lock(&worker->lock);
+    while (true) {
+        batch_t *batch = worker->fullHead;
+        if (batch == NULL) {
+            if (worker->done)
+                break;
+            pthread_cond_wait(&worker->changed, &worker->lock);
+            continue;
         }
+        if ((worker->fullHead = batch->next) == NULL)
+            worker->fullTail = NULL;
+        pthread_mutex_unlock(&worker->lock);
+
+        for (int i = 0; i < batch->count; i++)
+            executeInstruction(batch->items[i], &worker->cache, time++);
+
+        pthread_mutex_lock(&worker->lock);
+        batch->next = worker->free;
+        worker->free = batch;
+        pthread_cond_signal(&worker->changed);
     }
-    handleMiss(set, cache, time, isStore, tag);
+    pthread_mutex_unlock(&worker->lock);
+    return NULL;
 }
-// Reads the file lgiven by path line by line.
-// Each instruction is executed and cache is modified
-void parseFile(char *path, cache_t *cache) {
-    FILE *file;
 
-    // Trace file lines are probably not going to be longer than 8+8+2+3 = 21
-    const int maxLineLen = 24;
-    char linebuf[maxLineLen];
-    file = fopen(path, "r");
+// Where parsed instructions go. Normally each one is executed on cache as
+// soon as it is read. With -j on a single configuration, cache is NULL and
+// engine routes them to worker threads. In a sweep both are NULL and they
+// are saved in memory, to be simulated once per configuration. time counts
+// them
+typedef struct {
+    cache_t *cache;
+    engine_t *engine;
+    int time;
+    instruction_t *saved;
+    long numSaved;
+    long capacity;
+} sink_t;
+
+// Adds an instruction to the end of the saved trace
+void saveInstruction(sink_t *sink, instruction_t instruction) {
+    if (sink->numSaved == sink->capacity) {
+        sink->capacity = sink->capacity ? 2 * sink->capacity : 1 << 16;
+        sink->saved =
+            realloc(sink->saved, sink->capacity * sizeof(instruction_t));
+        if (sink->saved == NULL) {
+            printf("Allocation falurre \n");
+            exit(1);
+        }
+    }
+    sink->saved[sink->numSaved++] = instruction;
+}
+
+// Hands one parsed instruction to the sink
+static inline void consume(sink_t *sink, instruction_t instruction) {
+    if (sink->cache != NULL)
+        executeInstruction(instruction, sink->cache, sink->time);
+    else if (instruction.operation != 'S' && instruction.operation != 'L')
+        printf("Expected L or S. Got: %c  \n", instruction.operation);
+    else if (sink->engine != NULL)
+        routeInstruction(sink->engine, instruction);
+    else
+        saveInstruction(sink, instruction);
+    sink->time++;
+}
+
+// Consumes every complete line in buf up to end
+// Returns where the last, unfinished line starts (end if there is none)
+const char *parseBuffer(const char *buf, const char *end, sink_t *sink) {
     instruction_t instruction;
+    const char *newline;
 
-    int time = 1;
+    while ((newline = memchr(buf, '\n', end - buf)) != NULL) {
+        if (processLine(buf, newline, &instruction))
+            consume(sink, instruction);
+        buf = newline + 1;
+    }
+    return buf;
+}
 
-    while (fgets(linebuf, sizeof linebuf, file) != 0) {
+// Binary traces, as written by trace2bin, which describes the format. They
+// start with BIN_TRACE_MAGIC, then one record per access holding the zigzag
+// encoded difference from the previous address of the same kind, load or
+// store, and the size when it changes. The decoder is kept here so that
+// csim.c builds against the stock cachelab.h
+#define BIN_TRACE_MAGIC "CSIMBT01"
+#define BIN_TRACE_MAGIC_LEN 8
+// Most bytes taken by one record
+#define BIN_TRACE_MAX_RECORD 20
 
-        instruction = processLine(linebuf);
-        executeInstruction(instruction, cache, time);
-        time++;
+// State carried from one record to the next
+typedef struct {
+    // Address of the previous load and store
+    unsigned long address[2];
+    // Size of the previous access
+    unsigned long size;
+} trace_codec_t;
+
+// Whether the len bytes at buf start with the binary trace magic
+static bool isBinaryTrace(const void *buf, size_t len) {
+    return len >= BIN_TRACE_MAGIC_LEN &&
+           memcmp(buf, BIN_TRACE_MAGIC, BIN_TRACE_MAGIC_LEN) == 0;
+}
+
+// Reads a value stored 7 bits per byte, least significant first, into the
+// bits of *v from shift up
+// Returns where the next field starts, or NULL if it runs past end
+static const unsigned char *getVarint(const unsigned char *p,
+                                      const unsigned char *end,
+                                      unsigned long *v, int shift) {
+    unsigned long value = *v;
+    while (p < end && shift < 64) {
+        unsigned char byte = *p++;
+        value |= (unsigned long)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *v = value;
+            return p;
+        }
+        shift += 7;
     }
+    return NULL;
 }
-// creates an array of set structs, representing the cache's memory
-// Allocated all structs on the heap, must be freed
-set_t *makeSets(int setBits, int associativity) {
-    int numSets = 1 << setBits;
 
-    set_t *sets = malloc(sizeof(set_t) * numSets);
+// Decodes the record at p into instruction
+// Returns where the next record starts, or NULL if this one doesn't end
+// before end, in which case codec is left unchanged
+static const unsigned char *decodeAccess(trace_codec_t *codec,
+                                         const unsigned char *p,
+                                         const unsigned char *end,
+                                         instruction_t *instruction) {
+    if (p >= end)
+        return NULL;
+    unsigned char head = *p++;
+    unsigned long zigzag = head >> 3;
+    unsigned long size = codec->size;
 
-    if (sets == NULL)
+    if ((head & 4) && (p = getVarint(p, end, &zigzag, 5)) == NULL)
         return NULL;
+    if (head & 2) {
+        size = 0;
+        if ((p = getVarint(p, end, &size, 0)) == NULL)
+            return NULL;
+    }
+
+    int store = head & 1;
+    long delta = (long)(zigzag >> 1) ^ -(long)(zigzag & 1);
+    codec->address[store] += (unsigned long)delta;
+    codec->size = size;
+    instruction->operation = store ? 'S' : 'L';
+    instruction->address = (long)codec->address[store];
+    return p;
+}
+
+// Consumes every complete record of a binary trace in buf up to end, with
+// codec carrying the previous addresses between calls. Exits on a record
+// that doesn't decode though all of it is there
+// Returns where the last, unfinished record starts
+const char *parseBinary(const char *buf, const char *end, sink_t *sink,
+                        trace_codec_t *codec) {
+    const unsigned char *p = (const unsigned char *)buf;
+    const unsigned char *next;
+    instruction_t instruction;
 
-    for (int i = 0; i < numSets; i++) {
-        sets[i].tags = malloc(sizeof(long) * associativity);
-        sets[i].dirty = malloc(sizeof(bool) * associativity);
-        sets[i].lastModified = malloc(sizeof(int) * associativity);
-        sets[i].valid = malloc(sizeof(bool) * associativity);
+    while ((next = decodeAccess(codec, p, (const unsigned char *)end,
+                                &instruction)) != NULL) {
+        consume(sink, instruction);
+        p = next;
+    }
+    if ((const unsigned char *)end - p >= BIN_TRACE_MAX_RECORD) {
+        fprintf(stderr, "Malformed binary trace record\n");
+        exit(1);
+    }
+    return (const char *)p;
+}
+
+// Reads a trace that can't be mapped, such as standard input, in blocks of
+// at least readSize bytes. The buffer grows if a line doesn't fit
+void parseStream(int fd, sink_t *sink) {
+    const size_t readSize = 1 << 20;
+    size_t size = readSize;
+    size_t kept = 0;
+    char *buf = malloc(size);
+    ssize_t n;
+    // -1 until enough has been read to tell whether the trace is binary
+    int binary = -1;
+    trace_codec_t codec = {{0, 0}, 0};
+
+    if (buf == NULL) {
+        printf("Allocation falurre \n");
+        exit(1);
+    }
+    while ((n = read(fd, buf + kept, size - kept)) > 0) {
+        const char *end = buf + kept + n;
+        const char *rest = buf;
+
+        if (binary == -1 && end - buf >= BIN_TRACE_MAGIC_LEN) {
+            binary = isBinaryTrace(buf, end - buf);
+            if (binary)
+                rest += BIN_TRACE_MAGIC_LEN;
+        }
+        if (binary == 1)
+            rest = parseBinary(rest, end, sink, &codec);
+        else if (binary == 0)
+            rest = parseBuffer(rest, end, sink);
+
+        // Move the unfinished line to the front, growing the buffer if
+        // it is full
+        kept = end - rest;
+        memmove(buf, rest, kept);
+        if (size - kept < readSize) {
+            size *= 2;
+            if ((buf = realloc(buf, size)) == NULL) {
+                printf("Allocation falurre \n");
+                exit(1);
+            }
+        }
+    }
+    if (n < 0) {
+        perror("read");
+        exit(1);
+    }
+
+    if (binary == 1 && kept != 0) {
+        fprintf(stderr, "Binary trace ends in the middle of a record\n");
+        exit(1);
+    }
+
+    // The last line may have no newline
+    instruction_t instruction;
+    if (binary != 1 && processLine(buf, buf + kept, &instruction))
+        consume(sink, instruction);
+    free(buf);
+}
+
+// Reads the file given by path (standard input if NULL or "-") line by line.
+// Each instruction is handed to the sink
+// Returns the number of instructions
+long parseFile(char *path, sink_t *sink) {
+    int fd = STDIN_FILENO;
+    struct stat st;
+
+    sink->time = 1;
+    if (path != NULL && strcmp(path, "-") != 0 &&
+        (fd = open(path, O_RDONLY)) < 0) {
+        perror(path);
+        exit(1);
+    }
 
-        // Set desired default values
+    // Scan regular files in place
+    char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (map != MAP_FAILED) {
+        const char *end = map + st.st_size;
+
+        posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+        if (isBinaryTrace(map, st.st_size)) {
+            trace_codec_t codec = {{0, 0}, 0};
+            const char *rest =
+                parseBinary(map + BIN_TRACE_MAGIC_LEN, end, sink, &codec);
+            if (rest != end) {
+                fprintf(stderr,
+                        "Binary trace ends in the middle of a record\n");
+                exit(1);
+            }
+        } else {
+            instruction_t instruction;
+            const char *rest = parseBuffer(map, end, sink);
+            if (processLine(rest, end, &instruction))
+                consume(sink, instruction);
+        }
+        munmap(map, st.st_size);
+    } else {
+        parseStream(fd, sink);
+    }
+
+    if (fd != STDIN_FILENO)
+        close(fd);
+    return sink->time - 1;
+}
+// Bytes taken by the state of one set: its tags and use times, padded to a
+// multiple of 8 bytes, followed by its valid and dirty bitmasks and the
+// policyWords words of bits of its replacement policy
+size_t getSetStride(int associativity, int policyWords) {
+    size_t maskWords = (associativity + 63) / 64;
+    size_t stride = associativity * (sizeof(long) + sizeof(int));
+
+    stride = (stride + 7) & ~(size_t)7;
+    return stride + (2 * maskWords + policyWords) * sizeof(uint64_t);
+}
+
+// Words of bits a replacement policy keeps for each set
+int getPolicyWords(const policy_t *policy, int associativity) {
+    return policy->bitWords != NULL ? policy->bitWords(associativity) : 0;
+}
+
+// Allocates the state of every set in one block, representing the cache's
+// memory. Tags start at 0, lines invalid and clean, use times at -1, and
+// the policy's bits at 0 unless it seeds them. The block must be freed
+char *makeSets(int setBits, int associativity, const policy_t *policy) {
+    size_t numSets = (size_t)1 << setBits;
+    int policyWords = getPolicyWords(policy, associativity);
+    size_t stride = getSetStride(associativity, policyWords);
+
+    // Everything but the use times starts out zero
+    char *lines = calloc(numSets, stride);
+
+    if (lines == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < numSets; i++) {
+        int *lastModified =
+            (int *)(lines + i * stride + associativity * sizeof(long));
         for (int j = 0; j < associativity; j++) {
-            sets[i].tags[j] = 0;
-            sets[i].dirty[j] = false;
-            sets[i].valid[j] = false;
-            sets[i].lastModified[j] = -1;
+            lastModified[j] = -1;
+        }
+        if (policy->seed != NULL) {
+            policy->seed((uint64_t *)(lines + (i + 1) * stride -
+                                      policyWords * sizeof(uint64_t)),
+                         i);
         }
     }
-    return sets;
+    return lines;
 }
 
 // Initializes a cache struct
 // The returned struct is allocated in the heap and must be freed
 // returns NULL upon allocation failure
-cache_t *makeCache(set_t *sets, args_t args) {
+cache_t *makeCache(char *lines, args_t args) {
     cache_t *cache = malloc(sizeof(cache_t));
 
     if (cache == NULL)
         return NULL;
 
-    cache->sets = sets;
+    cache->lines = lines;
+    cache->policy = &policies[args.policy];
+    cache->policyWords = getPolicyWords(cache->policy, args.associativity);
+    cache->setStride =
+        getSetStride(args.associativity, cache->policyWords);
+    cache->maskWords = (args.associativity + 63) / 64;
     cache->blockBits = args.blockBits;
     cache->associativity = args.associativity;
     cache->setBits = args.setBits;
@@ -268,51 +1160,482 @@ cache_t *makeCache(set_t *sets, args_t args) {
     return cache;
 }
 
-// Frees an individual set struct
-void freeSet(set_t set) {
-    free(set.dirty);
-    free(set.lastModified);
-    free(set.tags);
-    free(set.valid);
+// Frees a cache stuct
+// assumes the set state within it is stll allocated
+void freeCache(cache_t *cache) {
+    free(cache->lines);
+    free(cache);
 }
 
-// Frees an array of length number of sets of set_t structs
-void freeSets(set_t *sets, int numSets) {
+// Every configuration of a sweep, the trace they are all run on, and the
+// stats of each once it has been simulated
+typedef struct {
+    const instruction_t *trace;
+    long length;
+    args_t *configs;
+    csim_stats_t *stats;
+    int numConfigs;
+    // Index of the next configuration to be claimed by a thread
+    int next;
+} sweep_t;
 
-    for (int i = 0; i < numSets; i++) {
-        freeSet(sets[i]);
+// Seconds elapsed since start
+double secondsSince(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Simulates a trace saved in memory on a cache with the given configuration
+void simulateSaved(const instruction_t *trace, long length, args_t config,
+                   csim_stats_t *stats) {
+    char *lines = makeSets(config.setBits, config.associativity,
+                           &policies[config.policy]);
+    cache_t *cache = lines != NULL ? makeCache(lines, config) : NULL;
+
+    if (cache == NULL) {
+        printf("Allocation falurre \n");
+        exit(1);
+    }
+    for (long i = 0; i < length; i++) {
+        executeInstruction(trace[i], cache, (int)(i + 1));
     }
-    free(sets);
+    *stats = cache->stats;
+    freeCache(cache);
 }
 
-// Frees a cache stuct
-// assumes the set strruct within it is stll allocated
-void freeCache(cache_t *cache) {
-    freeSets(cache->sets, 1 << cache->setBits);
-    free(cache);
+// Thread body of a sweep: claims and simulates configurations until none
+// are left. Each has its own cache, so threads share only the trace
+void *sweepWorker(void *arg) {
+    sweep_t *sweep = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&sweep->next, 1, __ATOMIC_RELAXED)) <
+           sweep->numConfigs) {
+        simulateSaved(sweep->trace, sweep->length, sweep->configs[i],
+                      &sweep->stats[i]);
+    }
+    return NULL;
+}
+
+// Simulates every combination of the -s, -E, -b and -r values on the trace
+// saved in sink, across args.threads threads, and prints a row for each
+void runSweep(args_t args, const sink_t *sink) {
+    sweep_t sweep;
+    int threads = args.threads;
+
+    sweep.trace = sink->saved;
+    sweep.length = sink->numSaved;
+    sweep.numConfigs = args.setList.count * args.assocList.count *
+                       args.blockList.count * args.policyList.count;
+    sweep.next = 0;
+    sweep.configs = malloc(sweep.numConfigs * sizeof(args_t));
+    sweep.stats = malloc(sweep.numConfigs * sizeof(csim_stats_t));
+    if (sweep.configs == NULL || sweep.stats == NULL) {
+        printf("Allocation falurre \n");
+        exit(1);
+    }
+
+    int n = 0;
+    for (int i = 0; i < args.setList.count; i++) {
+        for (int j = 0; j < args.assocList.count; j++) {
+            for (int k = 0; k < args.blockList.count; k++) {
+                for (int r = 0; r < args.policyList.count; r++) {
+                    args_t *config = &sweep.configs[n++];
+                    *config = args;
+                    config->setBits = args.setList.values[i];
+                    config->associativity = args.assocList.values[j];
+                    config->blockBits = args.blockList.values[k];
+                    config->policy = args.policyList.values[r];
+                }
+            }
+        }
+    }
+
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > sweep.numConfigs)
+        threads = sweep.numConfigs;
+    if (threads < 1)
+        threads = 1;
+
+    // The main thread works too
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    if (workers == NULL) {
+        printf("Allocation falurre \n");
+        exit(1);
+    }
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, sweepWorker, &sweep) != 0) {
+            fprintf(stderr, "Unable to start sweep thread\n");
+            exit(1);
+        }
+    }
+    sweepWorker(&sweep);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    printf("%3s %5s %3s %-6s %12s %12s %12s %7s %14s %14s\n", "s", "E", "b",
+           "policy", "hits", "misses", "evictions", "miss%", "dirty_bytes",
+           "dirty_evicted");
+    for (int i = 0; i < sweep.numConfigs; i++) {
+        args_t *c = &sweep.configs[i];
+        csim_stats_t *st = &sweep.stats[i];
+        long accesses = st->hits + st->misses;
+        printf("%3d %5d %3d %-6s %12ld %12ld %12ld %7.2f %14ld %14ld\n",
+               c->setBits, c->associativity, c->blockBits,
+               policies[c->policy].name, st->hits, st->misses, st->evictions,
+               accesses ? 100.0 * st->misses / accesses : 0.0, st->dirty_bytes,
+               st->dirty_evictions);
+    }
+    free(sweep.configs);
+    free(sweep.stats);
+}
+
+// Last use of each block seen by the stack distance pass, in a hash table
+// with open addressing. last is -1 in empty slots
+typedef struct {
+    unsigned long block;
+    long last;
+} lastUse_t;
+
+typedef struct {
+    lastUse_t *slots;
+    long capacity;
+    long used;
+} blockTable_t;
+
+// Finds the slot of block, or the empty slot where it belongs
+lastUse_t *findBlock(blockTable_t *table, unsigned long block) {
+    unsigned long mask = table->capacity - 1;
+    unsigned long i = (block * 0x9e3779b97f4a7c15UL) >> 20 & mask;
+
+    while (table->slots[i].last != -1 && table->slots[i].block != block)
+        i = (i + 1) & mask;
+    return &table->slots[i];
+}
+
+// Makes room for another block, doubling the table when it is half full
+void growBlockTable(blockTable_t *table) {
+    if (2 * (table->used + 1) <= table->capacity)
+        return;
+
+    blockTable_t old = *table;
+    table->capacity = old.capacity ? 2 * old.capacity : 1 << 12;
+    table->slots = malloc(table->capacity * sizeof(lastUse_t));
+    if (table->slots == NULL) {
+        printf("Allocation falurre \n");
+        exit(1);
+    }
+    for (long i = 0; i < table->capacity; i++)
+        table->slots[i].last = -1;
+    for (long i = 0; i < old.capacity; i++) {
+        if (old.slots[i].last != -1)
+            *findBlock(table, old.slots[i].block) = old.slots[i];
+    }
+    free(old.slots);
+}
+
+// Fenwick tree operations on one set's tree, indexed from 1
+static inline void treeAdd(int *tree, long size, long i, int delta) {
+    for (; i <= size; i += i & -i)
+        tree[i] += delta;
+}
+
+static inline long treeSum(const int *tree, long i) {
+    long sum = 0;
+    for (; i > 0; i -= i & -i)
+        sum += tree[i];
+    return sum;
+}
+
+// Computes the LRU stack distance of every access in the trace saved in
+// sink, for the sets and blocks given by -s and -b, and prints hits, misses,
+// evictions and the miss rate for each associativity
+//
+// Each set numbers its accesses 1, 2, ... and keeps a Fenwick tree with a 1
+// at the position of the latest use of each of its blocks. The distance of
+// an access is the number of 1s between it and the previous use of its
+// block, so the whole trace takes O(n log n)
+void runStackDistance(args_t args, const sink_t *sink) {
+    size_t numSets = (size_t)1 << args.setBits;
+    const instruction_t *trace = sink->saved;
+    long length = sink->numSaved;
+
+    // Lay out the trees of all sets in one array, each sized by how many
+    // accesses its set gets, and count each set's distinct blocks
+    long *start = calloc(numSets + 1, sizeof(long));
+    long *position = calloc(numSets, sizeof(long));
+    long *distinct = calloc(numSets, sizeof(long));
+    if (start == NULL || position == NULL || distinct == NULL) {
+        printf("Allocation falurre \n");
+        exit(1);
+    }
+    for (long i = 0; i < length; i++)
+        start[getSetNum(trace[i].address, args.setBits, args.blockBits) + 1]++;
+    for (size_t set = 0; set < numSets; set++)
+        start[set + 1] += start[set] + 1;
+    int *trees = calloc(start[numSets], sizeof(int));
+
+    // histogram[d] counts the accesses at distance d
+    long histSize = 64;
+    long *histogram = calloc(histSize, sizeof(long));
+    blockTable_t table = {NULL, 0, 0};
+    if (trees == NULL || histogram == NULL) {
+        printf("Allocation falurre \n");
+        exit(1);
+    }
+
+    for (long i = 0; i < length; i++) {
+        unsigned long block = (unsigned long)trace[i].address >> args.blockBits;
+        unsigned long set =
+            getSetNum(trace[i].address, args.setBits, args.blockBits);
+        int *tree = trees + start[set];
+        long size = start[set + 1] - start[set] - 1;
+        long now = ++position[set];
+
+        growBlockTable(&table);
+        lastUse_t *use = findBlock(&table, block);
+        if (use->last == -1) {
+            use->block = block;
+            table.used++;
+            distinct[set]++;
+        } else {
+            long distance = treeSum(tree, now - 1) - treeSum(tree, use->last);
+            if (distance >= histSize) {
+                long newSize = 2 * distance;
+                histogram = realloc(histogram, newSize * sizeof(long));
+                if (histogram == NULL) {
+                    printf("Allocation falurre \n");
+                    exit(1);
+                }
+                memset(histogram + histSize, 0,
+                       (newSize - histSize) * sizeof(long));
+                histSize = newSize;
+            }
+            histogram[distance]++;
+            treeAdd(tree, size, use->last, -1);
+        }
+        treeAdd(tree, size, now, 1);
+        use->last = now;
+    }
+
+    // setsWith[k] counts the sets with exactly k distinct blocks. A cache
+    // with E lines fills min(E, k) empty lines in such a set, and every
+    // other miss evicts
+    long maxDistinct = 0;
+    for (size_t set = 0; set < numSets; set++) {
+        if (distinct[set] > maxDistinct)
+            maxDistinct = distinct[set];
+    }
+    long *setsWith = calloc(maxDistinct + 2, sizeof(long));
+    if (setsWith == NULL) {
+        printf("Allocation falurre \n");
+        exit(1);
+    }
+    for (size_t set = 0; set < numSets; set++)
+        setsWith[distinct[set]]++;
+
+    // Rows to print: the -E values, or powers of two until the largest
+    // distance seen is covered
+    list_t rows = args.assocList;
+    int powers[32];
+    if (rows.values[0] == 0) {
+        long maxDistance = histSize - 1;
+        while (maxDistance > 0 && histogram[maxDistance] == 0)
+            maxDistance--;
+        rows.values = powers;
+        rows.count = 0;
+        for (long e = 1; rows.count < 31; e *= 2) {
+            powers[rows.count++] = (int)e;
+            if (e > maxDistance)
+                break;
+        }
+    }
+
+    printf("%7s %12s %12s %12s %7s\n", "E", "hits", "misses", "evictions",
+           "miss%");
+    for (int r = 0; r < rows.count; r++) {
+        long e = rows.values[r];
+        long hits = 0;
+        long fills = 0;
+        long setsAbove = numSets;
+
+        // Hits are the accesses at distances below E, and a set with k
+        // distinct blocks fills min(E, k) lines
+        for (long d = 0; d < e && d < histSize; d++)
+            hits += histogram[d];
+        for (long k = 0; k < e && k <= maxDistinct; k++) {
+            setsAbove -= setsWith[k];
+            fills += setsAbove;
+        }
+        long misses = length - hits;
+        printf("%7ld %12ld %12ld %12ld %7.2f\n", e, hits, misses,
+               misses - fills, length ? 100.0 * misses / length : 0.0);
+    }
+
+    free(setsWith);
+    free(table.slots);
+    free(histogram);
+    free(trees);
+    free(distinct);
+    free(position);
+    free(start);
+}
+
+// Starts threads workers simulating on cache, each owning the sets whose
+// number is its index modulo threads
+engine_t *startEngine(cache_t *cache, int threads) {
+    engine_t *engine = malloc(sizeof(engine_t));
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+
+    if (engine == NULL || workers == NULL) {
+        printf("Allocation falurre \n");
+        exit(1);
+    }
+    engine->workers = workers;
+    engine->numWorkers = threads;
+    engine->setBits = cache->setBits;
+    engine->blockBits = cache->blockBits;
+
+    for (int i = 0; i < threads; i++) {
+        worker_t *worker = &workers[i];
+
+        worker->cache = *cache;
+        memset(&worker->cache.stats, 0, sizeof(csim_stats_t));
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->changed, NULL);
+        worker->filling = takeBatch(worker);
+        if (pthread_create(&worker->thread, NULL, engineWorker, worker) != 0) {
+            fprintf(stderr, "Unable to start worker thread\n");
+            exit(1);
+        }
+    }
+    return engine;
+}
+
+// Queues what is left for each worker, waits for them to finish and adds
+// their stats into cache
+void finishEngine(engine_t *engine, cache_t *cache) {
+    for (int i = 0; i < engine->numWorkers; i++) {
+        worker_t *worker = &engine->workers[i];
+
+        submitBatch(worker);
+        pthread_mutex_lock(&worker->lock);
+        worker->done = true;
+        pthread_cond_signal(&worker->changed);
+        pthread_mutex_unlock(&worker->lock);
+    }
+    for (int i = 0; i < engine->numWorkers; i++) {
+        worker_t *worker = &engine->workers[i];
+        csim_stats_t *stats = &worker->cache.stats;
+
+        pthread_join(worker->thread, NULL);
+        cache->stats.hits += stats->hits;
+        cache->stats.misses += stats->misses;
+        cache->stats.evictions += stats->evictions;
+        cache->stats.dirty_bytes += stats->dirty_bytes;
+        cache->stats.dirty_evictions += stats->dirty_evictions;
+
+        while (worker->free != NULL) {
+            batch_t *batch = worker->free;
+            worker->free = batch->next;
+            free(batch);
+        }
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->changed);
+    }
+    free(engine->workers);
+    free(engine);
 }
 
 int main(int argc, char **argv) {
 
     args_t args = readArgs(argc, argv);
+#ifdef __x86_64__
+    useAvx2 = __builtin_cpu_supports("avx2");
+#endif
+    sink_t sink = {NULL, NULL, 0, NULL, 0, 0};
 
-    set_t *sets;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    sets = makeSets(args.setBits, args.associativity);
+    // Stack distances are found on a trace saved in memory
+    if (args.distances) {
+        if (args.setList.count > 1 || args.blockList.count > 1) {
+            fprintf(stderr, "-D takes one value of -s and -b\n");
+            return 1;
+        }
+        if (args.policyList.count > 1 || args.policy != findPolicy("lru")) {
+            fprintf(stderr, "-D finds LRU miss ratios only\n");
+            return 1;
+        }
+        long count = parseFile(args.tracefile, &sink);
+        double parseSecs = secondsSince(start);
+
+        runStackDistance(args, &sink);
+        if (args.verbose) {
+            fprintf(stderr,
+                    "%ld lines parsed in %.3f s, stack distances found in "
+                    "%.3f s\n",
+                    count, parseSecs, secondsSince(start) - parseSecs);
+        }
+        free(sink.saved);
+        return 0;
+    }
 
-    if (sets == NULL) {
+    // With more than one configuration, save the trace and sweep
+    if (args.setList.count * args.assocList.count * args.blockList.count *
+            args.policyList.count >
+        1) {
+        long count = parseFile(args.tracefile, &sink);
+        double parseSecs = secondsSince(start);
+
+        runSweep(args, &sink);
+        if (args.verbose) {
+            fprintf(stderr,
+                    "%ld lines parsed in %.3f s, configurations simulated "
+                    "in %.3f s\n",
+                    count, parseSecs, secondsSince(start) - parseSecs);
+        }
+        free(sink.saved);
+        return 0;
+    }
+
+    char *lines;
+
+    lines = makeSets(args.setBits, args.associativity, &policies[args.policy]);
+
+    if (lines == NULL) {
         printf("Allocation falurre \n");
         return 1;
     }
 
-    cache_t *cache = makeCache(sets, args);
+    cache_t *cache = makeCache(lines, args);
 
     if (cache == NULL) {
         printf("Allocation falurre \n");
         return 1;
     }
 
-    parseFile(args.tracefile, cache);
+    // With -j, workers simulate the sets while this thread parses
+    long count;
+    if (args.threads > 1) {
+        sink.engine = startEngine(cache, args.threads);
+        count = parseFile(args.tracefile, &sink);
+        finishEngine(sink.engine, cache);
+    } else {
+        sink.cache = cache;
+        count = parseFile(args.tracefile, &sink);
+    }
+
+    if (args.verbose) {
+        double secs = secondsSince(start);
+        fprintf(stderr, "%ld lines in %.3f s (%.2f M lines/s)\n", count, secs,
+                count / secs / 1e6);
+    }
 
     printSummary(&cache->stats);
 
@@ -0,0 +1,351 @@
+/**
+ * @file trace2bin.c
+ * @brief Converts memory traces between the text and binary formats
+ *
+ * Text traces have one access per line, "L 7ff000398,8". Binary traces
+ * store the same accesses with delta encoded addresses, in a byte or two
+ * each. csim reads either, with its own copy of the decoder, since csim.c
+ * is handed in on its own; the two must agree on the format below.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Binary traces start with BIN_TRACE_MAGIC, followed by one record per
+ * access. Each address is stored as its difference from the address of the
+ * previous access of the same kind, load or store, zigzag encoded so that
+ * small steps backwards stay small. Code that reads one array and writes
+ * another gets two small differences instead of two large ones. The size is
+ * only stored when it changes. A record is
+ *
+ *     byte 0:  bit 0     1 for a store, 0 for a load
+ *              bit 1     a size follows the address difference
+ *              bit 2     more bytes of the address difference follow
+ *              bits 3-7  low 5 bits of the address difference
+ *     then:    the rest of the address difference, 7 bits per byte with
+ *              the top bit set on all but the last byte, if bit 2 is set
+ *     then:    the size, 7 bits per byte the same way, if bit 1 is set
+ *
+ * so walking an array of doubles takes one byte per access.
+ */
+
+/** @brief Magic number at the start of a binary trace */
+#define BIN_TRACE_MAGIC "CSIMBT01"
+
+/** @brief Length of the binary trace magic number */
+#define BIN_TRACE_MAGIC_LEN 8
+
+/** @brief Most bytes taken by one access in a binary trace */
+#define BIN_TRACE_MAX_RECORD 20
+
+/**
+ * @brief Struct representing one memory access of a trace
+ */
+typedef struct {
+    char op;               /* 'L' or 'S' */
+    unsigned long address; /* address accessed */
+    unsigned long size;    /* bytes accessed, 0 if not given */
+} trace_access_t;
+
+/**
+ * @brief Struct holding the state carried from one access to the next
+ *        while a binary trace is encoded or decoded
+ */
+typedef struct {
+    unsigned long address[2]; /* address of the previous load and store */
+    unsigned long size;       /* size of the previous access */
+} trace_codec_t;
+
+/**
+ * @brief Writes v 7 bits per byte, least significant first
+ */
+static unsigned char *putVarint(unsigned char *p, unsigned long v) {
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+/**
+ * @brief Reads a value written by putVarint into *v
+ *
+ * @return Where the next field starts, or NULL if it runs past end
+ */
+static const unsigned char *getVarint(const unsigned char *p,
+                                      const unsigned char *end,
+                                      unsigned long *v, int shift) {
+    unsigned long value = *v;
+    while (p < end && shift < 64) {
+        unsigned char byte = *p++;
+        value |= (unsigned long)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *v = value;
+            return p;
+        }
+        shift += 7;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Encodes one access as the next record of a binary trace
+ *
+ * @param[in,out] codec  State left by the previous access, zero to start
+ * @param[in]     access The access to encode
+ * @param[out]    buf    At least BIN_TRACE_MAX_RECORD bytes
+ *
+ * @return Number of bytes written to buf
+ */
+static size_t encodeAccess(trace_codec_t *codec, const trace_access_t *access,
+                           unsigned char *buf) {
+    int store = access->op == 'S';
+    long delta = (long)(access->address - codec->address[store]);
+    unsigned long zigzag = ((unsigned long)delta << 1) ^ (delta >> 63);
+    unsigned char *p = buf + 1;
+
+    buf[0] = (unsigned char)(store | (zigzag & 0x1f) << 3);
+    if (access->size != codec->size) {
+        buf[0] |= 2;
+    }
+    if (zigzag >= 0x20) {
+        buf[0] |= 4;
+        p = putVarint(p, zigzag >> 5);
+    }
+    if (access->size != codec->size) {
+        p = putVarint(p, access->size);
+    }
+
+    codec->address[store] = access->address;
+    codec->size = access->size;
+    return (size_t)(p - buf);
+}
+
+/**
+ * @brief Decodes the next record of a binary trace
+ *
+ * @param[in,out] codec  State left by the previous access, zero to start
+ * @param[in]     p      Start of the record
+ * @param[in]     end    End of the bytes available
+ * @param[out]    access The access decoded
+ *
+ * @return Where the next record starts, or NULL if this one is incomplete,
+ *         in which case codec is left unchanged. A record that still
+ *         can't be decoded from BIN_TRACE_MAX_RECORD bytes is malformed
+ */
+static const unsigned char *decodeAccess(trace_codec_t *codec,
+                                         const unsigned char *p,
+                                         const unsigned char *end,
+                                         trace_access_t *access) {
+    if (p >= end) {
+        return NULL;
+    }
+    unsigned char head = *p++;
+    unsigned long zigzag = head >> 3;
+    unsigned long size = codec->size;
+
+    if ((head & 4) && (p = getVarint(p, end, &zigzag, 5)) == NULL) {
+        return NULL;
+    }
+    if (head & 2) {
+        size = 0;
+        if ((p = getVarint(p, end, &size, 0)) == NULL) {
+            return NULL;
+        }
+    }
+
+    int store = head & 1;
+    long delta = (long)(zigzag >> 1) ^ -(long)(zigzag & 1);
+    access->op = store ? 'S' : 'L';
+    access->address = codec->address[store] + (unsigned long)delta;
+    access->size = size;
+
+    codec->address[store] = access->address;
+    codec->size = size;
+    return p;
+}
+
+/**
+ * @brief Converts a text trace to a binary trace
+ *
+ * Each line of the text trace is an operation, L or S, an address in hex
+ * and optionally a comma and a size in decimal. Blank lines are skipped.
+ *
+ * @param[in]  in  The text trace
+ * @param[out] out Where the binary trace is written
+ *
+ * @return The number of accesses converted, or -1 on a malformed line
+ */
+static long textToBinaryTrace(FILE *in, FILE *out) {
+    trace_codec_t codec = {{0, 0}, 0};
+    unsigned char record[BIN_TRACE_MAX_RECORD];
+    char *line = NULL;
+    size_t cap = 0;
+    long count = 0;
+    long lineno = 0;
+
+    fwrite(BIN_TRACE_MAGIC, 1, BIN_TRACE_MAGIC_LEN, out);
+    while (getline(&line, &cap, in) != -1) {
+        trace_access_t access;
+        char *p = line;
+        char *next;
+
+        lineno++;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '\n' || *p == '\r' || *p == '\0') {
+            continue;
+        }
+        if ((*p != 'L' && *p != 'S') || (p[1] != ' ' && p[1] != '\t')) {
+            fprintf(stderr, "Line %ld: expected L or S: %s", lineno, line);
+            free(line);
+            return -1;
+        }
+        access.op = *p++;
+        access.address = strtoul(p, &next, 16);
+        if (next == p) {
+            fprintf(stderr, "Line %ld: expected an address: %s", lineno, line);
+            free(line);
+            return -1;
+        }
+        access.size = *next == ',' ? strtoul(next + 1, NULL, 10) : 0;
+
+        fwrite(record, 1, encodeAccess(&codec, &access, record), out);
+        count++;
+    }
+    free(line);
+    return count;
+}
+
+/**
+ * @brief Converts a binary trace to a text trace
+ *
+ * @param[in]  in  The binary trace
+ * @param[out] out Where the text trace is written
+ *
+ * @return The number of accesses converted, or -1 if in is not a binary
+ *         trace, has a malformed record or ends in the middle of one
+ */
+static long binaryToTextTrace(FILE *in, FILE *out) {
+    trace_codec_t codec = {{0, 0}, 0};
+    unsigned char buf[1 << 16];
+    size_t kept = 0;
+    size_t n;
+    long count = 0;
+
+    n = fread(buf, 1, BIN_TRACE_MAGIC_LEN, in);
+    if (n < BIN_TRACE_MAGIC_LEN ||
+        memcmp(buf, BIN_TRACE_MAGIC, BIN_TRACE_MAGIC_LEN) != 0) {
+        fprintf(stderr, "Not a binary trace\n");
+        return -1;
+    }
+    while ((n = fread(buf + kept, 1, sizeof(buf) - kept, in)) > 0) {
+        const unsigned char *p = buf;
+        const unsigned char *end = buf + kept + n;
+        const unsigned char *next;
+        trace_access_t access;
+
+        while ((next = decodeAccess(&codec, p, end, &access)) != NULL) {
+            if (access.size != 0) {
+                fprintf(out, "%c %lx,%lu\n", access.op, access.address,
+                        access.size);
+            } else {
+                fprintf(out, "%c %lx\n", access.op, access.address);
+            }
+            count++;
+            p = next;
+        }
+        kept = (size_t)(end - p);
+        if (kept >= BIN_TRACE_MAX_RECORD) {
+            fprintf(stderr, "Malformed binary trace record after %ld "
+                            "accesses\n",
+                    count);
+            return -1;
+        }
+        memmove(buf, p, kept);
+    }
+    if (kept != 0) {
+        fprintf(stderr, "Binary trace ends in the middle of a record\n");
+        return -1;
+    }
+    return count;
+}
+
+/**
+ * @brief Print usage info
+ */
+static void usage(char *argv[]) {
+    printf("Usage: %s [-hd] <in> <out>\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -d          Convert a binary trace back to text.\n");
+    printf("  <in> <out>  Trace files, - for standard input or output.\n");
+    printf("Example: %s traces/csim/long.trace long.bin\n", argv[0]);
+}
+
+/**
+ * @brief Opens path, or returns std if path is "-"
+ */
+static FILE *openTrace(const char *path, const char *mode, FILE *std) {
+    if (strcmp(path, "-") == 0) {
+        return std;
+    }
+    FILE *fp = fopen(path, mode);
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    return fp;
+}
+
+/**
+ * @brief Main routine
+ */
+int main(int argc, char *argv[]) {
+    bool decode = false;
+    char c;
+
+    while ((c = getopt(argc, argv, "hd")) != -1) {
+        switch (c) {
+        case 'd':
+            decode = true;
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+
+    if (argc - optind != 2) {
+        printf("Error: Expected an input and an output trace\n");
+        usage(argv);
+        exit(1);
+    }
+
+    FILE *in = openTrace(argv[optind], "r", stdin);
+    FILE *out = openTrace(argv[optind + 1], "w", stdout);
+
+    long count =
+        decode ? binaryToTextTrace(in, out) : textToBinaryTrace(in, out);
+
+    if (fclose(out) != 0) {
+        perror(argv[optind + 1]);
+        exit(1);
+    }
+    fclose(in);
+    if (count < 0) {
+        exit(1);
+    }
+    return 0;
+}
@@ -1,8 +1,17 @@
 /* Compute time used by function f */
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/times.h>
 
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "clock.h"
 #include "fcyc.h"
 
@@ -37,6 +46,19 @@ static long int samplecount = 0;
 static double *samples = NULL;
 #endif
 
+/* Hardware counters, in the order of the fields of fcyc_counts_t */
+#define NUM_EVENTS 6
+
+static int counters_enabled = 0;
+static int counter_fd[NUM_EVENTS] = {-1, -1, -1, -1, -1, -1};
+/* Position of each event in a read of the group, or -1 if it counts alone */
+static int counter_slot[NUM_EVENTS];
+static int group_fd = -1;
+static int group_size = 0;
+static const char *counter_error = NULL;
+static double counter_total[NUM_EVENTS];
+static long int counter_reps = 0;
+
 /* Initialize the minimum time threshold */
 static void init_min_time()
 {
@@ -123,6 +145,186 @@ static void clear()
     sink = x;
 }
 
+/* Code to read hardware counters */
+
+#ifdef __linux__
+/*
+ * The events are opened as one group, so the kernel schedules them onto
+ * the PMU together and they all count over the same intervals; otherwise
+ * ratios such as IPC could divide counts taken at different times. An
+ * event that doesn't fit in the group counts on its own. Either way, the
+ * counts are scaled by how long they were enabled over how long they were
+ * actually counting, in case the kernel multiplexed them.
+ */
+#define READ_FORMAT                                                            \
+    (PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING)
+
+/*
+ * Opens an event in the group led by group, or as a group of its own if
+ * group is -1. is_leader marks the event that leads the counters' group;
+ * an event counting alone is not a leader, and is read without the group
+ * format.
+ */
+static int open_event(unsigned int type, unsigned long long config,
+                      int group, int is_leader)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    /* Group members start and stop with their leader */
+    attr.disabled = is_leader;
+    attr.read_format = READ_FORMAT | (is_leader ? PERF_FORMAT_GROUP : 0);
+    /* User-space counts need the least privilege */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+#define CACHE_READ_MISS(cache)                                                 \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |                            \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static void open_counters()
+{
+    static const struct
+    {
+        unsigned int type;
+        unsigned long long config;
+    } events[NUM_EVENTS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    };
+    int i, opened = 0, err = 0;
+
+    group_fd = -1;
+    group_size = 0;
+    for (i = 0; i < NUM_EVENTS; i++)
+    {
+        counter_slot[i] = -1;
+        counter_fd[i] = open_event(events[i].type, events[i].config, group_fd,
+                                   group_fd < 0);
+        if (counter_fd[i] >= 0)
+        {
+            if (group_fd < 0)
+                group_fd = counter_fd[i];
+            counter_slot[i] = group_size++;
+        }
+        else if (group_fd >= 0)
+        {
+            /* Too many events for the PMU to count at once */
+            counter_fd[i] = open_event(events[i].type, events[i].config, -1, 0);
+        }
+        if (counter_fd[i] >= 0)
+            opened++;
+        else if (!err)
+            err = errno;
+    }
+    if (!opened)
+        counter_error = strerror(err);
+}
+
+static void close_counters()
+{
+    int i;
+    /* Close the members before their leader */
+    for (i = NUM_EVENTS - 1; i >= 0; i--)
+    {
+        if (counter_fd[i] >= 0)
+            close(counter_fd[i]);
+        counter_fd[i] = -1;
+    }
+    group_fd = -1;
+    group_size = 0;
+}
+
+/* Apply op to the group as a whole and to each event counting alone */
+static void counters_ioctl(unsigned long op)
+{
+    int i;
+    if (group_fd >= 0)
+        ioctl(group_fd, op, PERF_IOC_FLAG_GROUP);
+    for (i = 0; i < NUM_EVENTS; i++)
+    {
+        if (counter_fd[i] >= 0 && counter_slot[i] < 0)
+            ioctl(counter_fd[i], op, 0);
+    }
+}
+
+static void start_counters()
+{
+    counters_ioctl(PERF_EVENT_IOC_RESET);
+    counters_ioctl(PERF_EVENT_IOC_ENABLE);
+}
+
+/* Scales a count to the whole time its event was enabled */
+static double scale_count(unsigned long long count, unsigned long long enabled,
+                          unsigned long long running)
+{
+    if (running == 0)
+        return 0;
+    return (double)count * ((double)enabled / (double)running);
+}
+
+/* Stop the counters and add what they counted during reps calls */
+static void stop_counters(long int reps)
+{
+    int i;
+    /* nr, time enabled, time running and one value per member */
+    unsigned long long group[3 + NUM_EVENTS];
+    /* value, time enabled, time running */
+    unsigned long long alone[3];
+    ssize_t group_bytes = (ssize_t)((3 + group_size) * sizeof(group[0]));
+
+    counters_ioctl(PERF_EVENT_IOC_DISABLE);
+    int group_read =
+        group_fd >= 0 && read(group_fd, group, sizeof(group)) == group_bytes;
+    for (i = 0; i < NUM_EVENTS; i++)
+    {
+        if (counter_fd[i] < 0)
+            continue;
+        if (counter_slot[i] >= 0 && group_read)
+            counter_total[i] +=
+                scale_count(group[3 + counter_slot[i]], group[1], group[2]);
+        else if (counter_slot[i] < 0 &&
+                 read(counter_fd[i], alone, sizeof(alone)) ==
+                     (ssize_t)sizeof(alone))
+            counter_total[i] += scale_count(alone[0], alone[1], alone[2]);
+    }
+    counter_reps += reps;
+}
+#else
+static void open_counters()
+{
+    counter_error = "perf_event_open is only available on Linux";
+}
+
+static void close_counters()
+{
+}
+
+static void start_counters()
+{
+}
+
+static void stop_counters(long int reps)
+{
+    counter_reps += reps;
+}
+#endif
+
+/* Start a new set of counter samples */
+static void init_counters()
+{
+    memset(counter_total, 0, sizeof(counter_total));
+    counter_reps = 0;
+}
+
 double fcyc(test_funct f, void *args)
 {
     double result;
@@ -146,16 +348,21 @@ double fcyc(test_funct f, void *args)
             reps += reps;
     }
     init_sampler();
+    init_counters();
     do
     {
         if (clear_cache)
             clear();
+        if (counters_enabled)
+            start_counters();
         start_counter();
         for (r = 0; r < reps; r++)
         {
             f(args);
         }
         cyc = (double)get_counter() / reps;
+        if (counters_enabled)
+            stop_counters(reps);
         if (cyc > 0.0)
             add_sample(cyc);
     } while (!has_converged() && samplecount < maxsamples);
@@ -190,17 +397,22 @@ double fsec(test_funct f, void *args)
         //        printf("uSecs = %.3f, reps = %ld\n", sec * 1e6, reps);
     }
     init_sampler();
+    init_counters();
     //    printf("\nuSecs (reps=%ld):", reps);
     do
     {
         if (clear_cache)
             clear();
+        if (counters_enabled)
+            start_counters();
         start_timer();
         for (r = 0; r < reps; r++)
         {
             f(args);
         }
         sec = get_timer() / reps;
+        if (counters_enabled)
+            stop_counters(reps);
         //        printf(" %.3f", sec * 1e6);
         if (sec > 0.0)
             add_sample(sec);
@@ -285,3 +497,49 @@ void set_fcyc_epsilon(double epsilon_arg)
 {
     epsilon = epsilon_arg;
 }
+
+/* When set, fcyc and fsec also count hardware events
+   Default = 0
+*/
+int set_fcyc_counters(int enable)
+{
+    if (enable && !counters_enabled)
+    {
+        counter_error = NULL;
+        open_counters();
+        counters_enabled = (counter_error == NULL);
+        return counters_enabled;
+    }
+    if (!enable && counters_enabled)
+    {
+        close_counters();
+        counters_enabled = 0;
+    }
+    return counters_enabled;
+}
+
+/* Reason the hardware counters are unavailable, or NULL */
+const char *fcyc_counters_error(void)
+{
+    return counter_error;
+}
+
+/* Get the hardware event counts per call of the last fcyc or fsec run */
+int get_fcyc_counts(fcyc_counts_t *counts)
+{
+    double per_call[NUM_EVENTS];
+    int i;
+
+    if (!counters_enabled || counter_reps == 0)
+        return 0;
+    for (i = 0; i < NUM_EVENTS; i++)
+        per_call[i] =
+            counter_fd[i] >= 0 ? counter_total[i] / counter_reps : -1.0;
+    counts->cycles = per_call[0];
+    counts->instructions = per_call[1];
+    counts->l1d_misses = per_call[2];
+    counts->llc_misses = per_call[3];
+    counts->branch_misses = per_call[4];
+    counts->dtlb_misses = per_call[5];
+    return 1;
+}
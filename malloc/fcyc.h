@@ -7,6 +7,20 @@
 
 typedef void (*test_funct)(void *);
 
+/* Hardware event counts per call of the test function, averaged over the
+   timed samples of the last fcyc or fsec run.  A count is negative if
+   that event could not be measured on this machine.
+*/
+typedef struct
+{
+    double cycles;
+    double instructions;
+    double l1d_misses;    /* L1 data cache read misses */
+    double llc_misses;    /* last-level cache misses */
+    double branch_misses; /* mispredicted branches */
+    double dtlb_misses;   /* data TLB read misses */
+} fcyc_counts_t;
+
 /* Compute number of cycles used by function f on given set of parameters */
 double fcyc(test_funct f, void *args);
 
@@ -57,3 +71,19 @@ void set_fcyc_maxsamples(long int maxsamples);
    Default = 0.01
 */
 void set_fcyc_epsilon(double epsilon);
+
+/* When set, fcyc and fsec also count hardware events with perf_event_open
+   while they take their timed samples.  Returns 0 if no counter could be
+   opened, in which case the reason is available from
+   fcyc_counters_error().
+   Default = 0
+*/
+int set_fcyc_counters(int enable);
+
+/* Reason the hardware counters are unavailable, or NULL */
+const char *fcyc_counters_error(void);
+
+/* Get the hardware event counts of the last fcyc or fsec run.
+   Returns 0 if counters are disabled or unavailable.
+*/
+int get_fcyc_counts(fcyc_counts_t *counts);
@@ -0,0 +1,188 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+#
+# heapmap.pl - Show where the free space is in mdriver heap snapshots
+#
+# mdriver -Y FILE appends a snapshot of the heap to FILE at the end of
+# each trace, and after the requests listed with -y. Each snapshot is
+#
+#     header:  char magic[8] = "MMSNAP01"
+#              uint32 op            request after which it was taken
+#              uint32 name_len      length of the trace name
+#              uint64 heap_size
+#              uint64 num_blocks
+#     name:    name_len bytes, padded with nulls to a multiple of 8
+#     block:   uint64 offset        of the block from the start of the heap
+#              uint64 info          size << 8 | free list class, or 0xff
+#                                   if the block is allocated
+#
+# in the byte order of the machine that ran mdriver.
+#
+# For each snapshot selected, heapmap.pl prints a summary of the heap, a
+# map in which every character stands for an equal share of the heap,
+#
+#     '#' allocated   '+' mostly allocated   '.' mostly free   ' ' free
+#
+# and the number and bytes of free blocks by power-of-two size and by
+# free list class. With -p it also writes the map of the last selected
+# snapshot as a PGM image, one pixel per share, darker where more of it
+# is allocated.
+#
+
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-hl] [-n N] [-w COLS] [-r ROWS] [-p PGM] FILE\n";
+    printf STDERR "Options:\n";
+    printf STDERR "   -h              Print this message\n";
+    printf STDERR "   -l              Only list the snapshots in FILE\n";
+    printf STDERR "   -n N            Show snapshot N (default: all)\n";
+    printf STDERR "   -w COLS         Width of the map (default 64)\n";
+    printf STDERR "   -r ROWS         Height of the map (default 16)\n";
+    printf STDERR "   -p PGM          Write the map to PGM, 1024 pixels wide\n";
+    die "\n";
+}
+
+getopts('hln:w:r:p:');
+
+if ($opt_h || @ARGV != 1) {
+    &usage($ARGV[0]);
+}
+
+$cols = $opt_w || 64;
+$rows = $opt_r || 16;
+$magic = "MMSNAP01";
+$ALLOC = 0xff;
+
+$infile = $ARGV[0];
+open(IN, "<", $infile) || die "Couldn't open snapshots '$infile'\n";
+binmode(IN);
+
+#
+# read_snapshot - Read the next snapshot. Returns its header fields, and
+# the blocks as a packed string if $want is set.
+#
+sub read_snapshot
+{
+    my ($want) = @_;
+    my ($buf, $name, $blocks);
+    my $n = read(IN, $buf, 32);
+    return () if ($n == 0);
+    die "$infile: truncated snapshot header\n" if ($n != 32);
+    my ($m, $op, $name_len, $heap_size, $num_blocks) =
+        unpack("a8 L L Q Q", $buf);
+    die "$infile: bad magic number\n" if ($m ne $magic);
+    read(IN, $name, ($name_len + 7) & ~7);
+    $name = substr($name, 0, $name_len);
+    if ($want) {
+        read(IN, $blocks, 16 * $num_blocks) == 16 * $num_blocks ||
+            die "$infile: truncated snapshot of $name\n";
+    } else {
+        seek(IN, 16 * $num_blocks, 1);
+    }
+    return ($name, $op, $heap_size, $num_blocks, $blocks);
+}
+
+#
+# show_snapshot - Print the summary, map and free block distributions
+#
+sub show_snapshot
+{
+    my ($index, $name, $op, $heap_size, $num_blocks, $blocks) = @_;
+    my $cells = $opt_p ? 1024 * $rows : $cols * $rows;
+    my $cell_bytes = int(($heap_size + $cells - 1) / $cells) || 1;
+    my @alloc = (0) x $cells;       # allocated bytes in each cell
+    my (%by_log, %by_class);
+    my ($alloc_bytes, $free_bytes, $num_free, $largest) = (0, 0, 0, 0);
+
+    foreach my $b (0 .. $num_blocks - 1) {
+        my ($offset, $info) = unpack("Q Q", substr($blocks, 16 * $b, 16));
+        my $size = $info >> 8;
+        my $class = $info & 0xff;
+        if ($class == $ALLOC) {
+            $alloc_bytes += $size;
+            # Spread the block over the cells it covers
+            my ($lo, $hi) = ($offset, $offset + $size);
+            while ($lo < $hi) {
+                my $c = int($lo / $cell_bytes);
+                last if ($c >= $cells);
+                my $end = ($c + 1) * $cell_bytes;
+                $end = $hi if ($hi < $end);
+                $alloc[$c] += $end - $lo;
+                $lo = $end;
+            }
+        } else {
+            $num_free++;
+            $free_bytes += $size;
+            $largest = $size if ($size > $largest);
+            my $log = 0;
+            $log++ while ((2 << $log) <= $size);
+            $by_log{$log}[0]++;
+            $by_log{$log}[1] += $size;
+            $by_class{$class}[0]++;
+            $by_class{$class}[1] += $size;
+        }
+    }
+
+    printf "Snapshot %d: %s after request %d\n", $index, $name, $op;
+    printf "  heap %d bytes in %d blocks: %d allocated (%.1f%%), " .
+        "%d free in %d blocks (%.1f%%)\n", $heap_size, $num_blocks,
+        $alloc_bytes, 100 * $alloc_bytes / ($heap_size || 1), $free_bytes,
+        $num_free, 100 * $free_bytes / ($heap_size || 1);
+    printf "  largest free block %d bytes; external fragmentation %.1f%%\n",
+        $largest, $free_bytes ? 100 * (1 - $largest / $free_bytes) : 0;
+
+    if ($opt_p) {
+        open(PGM, ">", $opt_p) || die "Couldn't write '$opt_p'\n";
+        binmode(PGM);
+        printf PGM "P5\n1024 %d\n255\n", $rows;
+        print PGM pack("C*", map { 255 - int(255 * $_ / $cell_bytes) } @alloc);
+        close(PGM);
+    } else {
+        printf "  map, %.0f bytes per character:\n", $cell_bytes;
+        foreach my $r (0 .. $rows - 1) {
+            my $line = "";
+            foreach my $c ($r * $cols .. ($r + 1) * $cols - 1) {
+                my $f = $alloc[$c] / $cell_bytes;
+                $line .= $f >= 0.999 ? "#" : $f >= 0.5 ? "+" :
+                         $f > 0.001 ? "." : " ";
+            }
+            print "  |$line|\n";
+        }
+    }
+
+    printf "  free blocks by size:\n";
+    printf "  %22s %9s %14s %7s\n", "bytes", "blocks", "total", "of free";
+    foreach my $log (sort { $a <=> $b } keys(%by_log)) {
+        printf "  %10d - %9d %9d %14d %6.1f%%\n", 1 << $log,
+            (2 << $log) - 1, $by_log{$log}[0], $by_log{$log}[1],
+            100 * $by_log{$log}[1] / $free_bytes;
+    }
+    printf "  free blocks by free list class:\n";
+    foreach my $class (sort { $a <=> $b } keys(%by_class)) {
+        printf "  %22s %9d %14d %6.1f%%\n", "class $class",
+            $by_class{$class}[0], $by_class{$class}[1],
+            100 * $by_class{$class}[1] / $free_bytes;
+    }
+    print "\n";
+}
+
+$index = 0;
+while (1) {
+    my $want = !$opt_l && (!defined($opt_n) || $opt_n == $index);
+    my @snap = &read_snapshot($want);
+    last if (!@snap);
+    if ($opt_l) {
+        printf "%4d  %s after request %d: %d bytes, %d blocks\n", $index,
+            @snap[0 .. 3];
+    } elsif ($want) {
+        &show_snapshot($index, @snap);
+    }
+    $index++;
+}
+close(IN);
+
+if (defined($opt_n) && $opt_n >= $index) {
+    die "$infile has only $index snapshots\n";
+}
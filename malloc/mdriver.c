@@ -9,15 +9,22 @@
  */
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -25,6 +32,11 @@
 #include <sanitizer/msan_interface.h>
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "clock.h"
 #include "config.h"
 #include "fcyc.h"
 #include "memlib.h"
@@ -45,6 +57,10 @@
 #define REF_ONLY 0
 #endif
 
+#ifndef COMPARE_MODE
+#define COMPARE_MODE 0
+#endif
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p) ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
@@ -104,6 +120,24 @@ typedef struct
     size_t size; /* byte size of alloc/realloc request */
 } traceop_t;
 
+/*
+ * Binary trace files (see rep2bin.pl) start with this header, followed by
+ * num_ops traceop_t records that are mapped into memory as they are.
+ */
+#define BINTRACE_MAGIC "MLRPBIN1"
+typedef struct
+{
+    char magic[8]; /* BINTRACE_MAGIC, without the terminating null */
+    int32_t weight;
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t unused;
+    uint64_t data_bytes;
+} bintrace_header_t;
+
+_Static_assert(sizeof(traceop_t) == 16 && sizeof(bintrace_header_t) == 32,
+               "binary trace records must match rep2bin.pl");
+
 /* Holds the information for one trace file */
 typedef struct
 {
@@ -113,9 +147,13 @@ typedef struct
     int num_ops;          /* number of distinct requests */
     weight_t weight;      /* weight for this trace */
     traceop_t *ops;       /* array of requests */
+    void *map;            /* mapping ops points into, for binary traces */
+    size_t map_len;       /* length of the mapping */
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
     size_t *block_rand_base; /* index into random_data, if debug is on */
+    int *threads;         /* thread of each request, or NULL if all are 0 */
+    int num_threads;      /* number of threads in the trace */
 } trace_t;
 
 /*
@@ -129,6 +167,32 @@ typedef struct
     range_set_t *ranges;
 } speed_t;
 
+/*
+ * Per-request latency histograms (-L). Latencies are in time stamp counter
+ * ticks, bucketed with LAT_SUB_BITS bits of precision below the leading
+ * bit, so each bucket is at most 1/4 of its value wide.
+ */
+#define LAT_SUB_BITS 2
+#define LAT_BUCKETS (64 << LAT_SUB_BITS)
+#define LAT_TYPES 3 /* one histogram per traceop_t type */
+
+/*
+ * The -U timeline samples each trace about TIMELINE_SAMPLES times, with
+ * up to TIMELINE_MAX_CLASSES per-class free byte columns
+ */
+#define TIMELINE_SAMPLES 1000
+#define TIMELINE_MAX_CLASSES 64
+
+/* Latency summary for one request type on one trace */
+typedef struct
+{
+    size_t count; /* number of requests */
+    double p50;   /* percentiles, as bucket upper bounds */
+    double p99;
+    double p999;
+    double max; /* exact */
+} latency_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct
 {
@@ -144,6 +208,12 @@ typedef struct
 
     /* defined only for the student malloc package */
     double util; /* space utilization for this trace (always 0 for libc) */
+    latency_t latency[LAT_TYPES]; /* per request type, with -L */
+    double p99;                   /* over all requests, with -L */
+    double time_util;             /* utilization averaged over requests */
+    size_t sbrk_calls;            /* mem_sbrk calls in the util replay */
+    bool has_counts;              /* hardware counters measured (-H) */
+    fcyc_counts_t counts;         /* events per replay of the trace */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -157,12 +227,27 @@ typedef struct
     double tput; /* average throughput expressed in Kops/s */
 } sum_stats_t;
 
+/* One row of a -R report: the results of one allocator on one trace */
+typedef struct
+{
+    char allocator[32];
+    char trace[MAXLINE]; /* file name without its directory */
+    bool valid;
+    double ops;
+    double ops_per_sec;
+    double util;
+    double p99;        /* ticks, or negative if latency wasn't measured */
+    size_t sbrk_calls; /* mem_sbrk calls while measuring util */
+} report_row_t;
+
 /********************
  * For debugging.  If debug-mode is on, then we have each block start
  * at a "random" place (a hash of the index), and copy random data
  * into it.  With DBG_CHEAP, we check that the data survived when we
  * realloc and when we free.  With DBG_EXPENSIVE, we check every block
- * every operation.
+ * every operation.  With DBG_INCREMENTAL, we only have the package check
+ * the blocks touched by the last operation, and do the DBG_EXPENSIVE
+ * checks every full_check_interval operations.
  * randint_t should be a byte, in case students return unaligned memory.
  *******************/
 #define RANDOM_DATA_LEN (1 << 16)
@@ -180,13 +265,50 @@ typedef enum
 {
     DBG_NONE,
     DBG_CHEAP,
-    DBG_EXPENSIVE
+    DBG_EXPENSIVE,
+    DBG_INCREMENTAL
 } debug_mode_t;
 
 static debug_mode_t debug_mode = REF_ONLY ? DBG_NONE : DBG_CHEAP;
+/* With DBG_INCREMENTAL, do a full check this often (0 = never) */
+static int full_check_interval = 0;
 int verbose = REF_ONLY ? 0 : 1; /* global flag for verbose output */
 static int errors = 0; /* number of errs found when running student malloc */
 static bool onetime_flag = false;
+/* Number of worker processes checking traces (set by -j) */
+static int num_jobs = 1;
+/* If set, measure the latency of every request (set by -L) */
+static bool latency_mode = false;
+/* If set, count hardware events while measuring throughput (set by -H) */
+static bool counter_mode = false;
+/* Most threads to replay multithreaded traces with, or 0 (set by -M) */
+static int max_threads = 0;
+/* How the speed runs use the payloads (set by -P) */
+static enum
+{
+    TOUCH_NONE = 0,
+    TOUCH_FILL = 1,  /* write payloads when allocated, read them when freed */
+    TOUCH_CHASE = 2, /* link the live blocks and walk the links */
+    TOUCH_BOTH = TOUCH_FILL | TOUCH_CHASE
+} touch_mode = TOUCH_NONE;
+/* Machine-readable report to write (set by -R) */
+static char *report_file = NULL;
+/* Report from an earlier run to check for regressions (set by -G) */
+static char *baseline_file = NULL;
+/* Percentage by which a result may be worse than the baseline (set by -g) */
+static double regress_threshold = 10.0;
+/*
+ * Timings of each trace whose median is its throughput when writing or
+ * checking a report, since one timing varies too much to compare
+ */
+#define REPORT_SPEED_RUNS 5
+/* CSV file receiving the utilization timeline of each trace (set by -U) */
+static FILE *timeline_fp = NULL;
+/* File receiving heap snapshots (set by -Y), and the requests after which
+   they are taken besides the last one (set by -y), in increasing order */
+static FILE *snapshot_fp = NULL;
+static int *snapshot_ops = NULL;
+static int num_snapshot_ops = 0;
 static bool tab_mode = false; /* Print output as tab-separated fields */
 /* If set, use sparse memory emulation */
 static bool sparse_mode = SPARSE_MODE;
@@ -221,6 +343,70 @@ static char autoresult[MAXLINE]; /* autoresult string */
 static sum_stats_t global_libc_sum_stats;
 static sum_stats_t global_mm_sum_stats;
 
+#if COMPARE_MODE
+/*
+ * mdriver-compare links several malloc packages into one driver. Every
+ * package other than mm.c is compiled with its entry points renamed to
+ * <name>_init, <name>_malloc, ... (see ALLOC_RENAME in the Makefile), and
+ * the evaluation routines call whichever package is current.
+ */
+typedef struct
+{
+    const char *name;
+    bool (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    bool (*checkheap)(int line);
+    bool (*checkheap_incremental)(int line);
+    int (*seglist_free_bytes)(size_t *bytes, int max_classes); /* or NULL */
+    void (*walk_heap)(mm_visit_t visit, void *arg);             /* or NULL */
+} allocator_t;
+
+extern bool buddy_init(void);
+extern void *buddy_malloc(size_t size);
+extern void buddy_free(void *ptr);
+extern void *buddy_realloc(void *ptr, size_t size);
+extern bool buddy_checkheap(int line);
+
+extern bool naive_init(void);
+extern void *naive_malloc(size_t size);
+extern void naive_free(void *ptr);
+extern void *naive_realloc(void *ptr, size_t size);
+extern bool naive_checkheap(int line);
+
+static const allocator_t allocators[] = {
+    {"mm", mm_init, mm_malloc, mm_free, mm_realloc, mm_checkheap,
+     mm_checkheap_incremental, mm_seglist_free_bytes, mm_walk_heap},
+    {"buddy", buddy_init, buddy_malloc, buddy_free, buddy_realloc,
+     buddy_checkheap, buddy_checkheap, NULL, NULL},
+    {"naive", naive_init, naive_malloc, naive_free, naive_realloc,
+     naive_checkheap, naive_checkheap, NULL, NULL},
+};
+#define NUM_ALLOCATORS ((int)(sizeof(allocators) / sizeof(allocators[0])))
+
+static const allocator_t *cur_allocator = &allocators[0];
+
+#define mm_init() (cur_allocator->init())
+#define mm_malloc(size) (cur_allocator->malloc(size))
+#define mm_free(ptr) (cur_allocator->free(ptr))
+#define mm_realloc(ptr, size) (cur_allocator->realloc(ptr, size))
+#define mm_checkheap(line) (cur_allocator->checkheap(line))
+#define mm_checkheap_incremental(line) \
+    (cur_allocator->checkheap_incremental(line))
+#else
+/*
+ * Packages without an incremental checker, such as the reference
+ * solutions, leave this undefined and get a full check instead.
+ */
+extern bool mm_checkheap_incremental(int line) __attribute__((weak));
+extern void mm_set_incremental_checks(bool incremental) __attribute__((weak));
+extern int mm_seglist_free_bytes(size_t *bytes, int max_classes)
+    __attribute__((weak));
+extern void mm_walk_heap(mm_visit_t visit, void *arg) __attribute__((weak));
+#define NUM_ALLOCATORS 1 /* just mm */
+#endif /* COMPARE_MODE */
+
 /* Performance statistics for driver */
 
 /*********************
@@ -240,6 +426,7 @@ static void free_range_set(range_set_t *ranges);
 /* These functions implement the debugging code */
 static void init_random_data(void);
 static bool check_index(const trace_t *trace, int opnum, int index);
+static bool check_heap_incremental(void);
 static void randomize_block(trace_t *trace, int index);
 
 /* These functions read, allocate, and free storage for traces */
@@ -255,11 +442,27 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, double *time_util);
 static void eval_mm_speed(void *ptr);
+static void run_scaling(int num_tracefiles, const char *tracedir,
+                        char **tracefiles, bool run_libc);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printlatency(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static double time_speed(test_funct f, void *params);
+static void printtimeline(int n, stats_t *stats);
+static void parse_snapshot_ops(const char *list);
+static const char *trace_basename(const char *filename);
+static void write_report(const char *path, int n, int num_allocs,
+                         const char **names, stats_t **stats);
+static int check_baseline(const char *path, int n, int num_allocs,
+                          const char **names, stats_t **stats);
+#if COMPARE_MODE
+static void printcomparison(int n, stats_t **stats);
+#endif
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3, 4)));
@@ -283,6 +486,22 @@ static void timeout_handler(int sig __attribute__((unused)))
 static double lookup_ref_throughput(bool checkpoint);
 static double measure_ref_throughput(bool checkpoint);
 
+/*
+ * What a worker process reports back for each trace it checked
+ */
+typedef struct
+{
+    int index;         /* which trace */
+    bool valid;        /* was it processed correctly? */
+    double util;       /* space utilization, if valid */
+    size_t sbrk_calls; /* mem_sbrk calls while measuring util */
+    int errors;        /* errors found while checking it */
+} trace_result_t;
+
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats,
+                               speed_t *speed_params);
+
 /*
  * Run the tests; return the number of tests run (may be less than
  * num_tracefiles, if there's a timeout)
@@ -293,6 +512,15 @@ static void run_tests(int num_tracefiles, const char *tracedir,
 {
     volatile int i;
 
+    /* Workers would interleave their rows in the timeline and snapshots */
+    if (num_jobs > 1 && !onetime_flag && timeline_fp == NULL &&
+        snapshot_fp == NULL)
+    {
+        run_tests_parallel(num_tracefiles, tracedir, tracefiles, mm_stats,
+                           speed_params);
+        return;
+    }
+
     for (i = 0; i < num_tracefiles; i++)
     {
         /* initialize simulated memory system in memlib.c *
@@ -336,14 +564,19 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i].time_util);
+            mm_stats[i].sbrk_calls = mem_sbrk_calls();
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
             mm_stats[i].secs =
-                sparse_mode ? 1.0 : fsec(eval_mm_speed, speed_params);
+                sparse_mode ? 1.0 : time_speed(eval_mm_speed, speed_params);
             mm_stats[i].tput = mm_stats[i].ops / (mm_stats[i].secs * 1000.0);
+            if (counter_mode && !sparse_mode)
+                mm_stats[i].has_counts = get_fcyc_counts(&mm_stats[i].counts);
+            if (latency_mode && !sparse_mode)
+                eval_mm_latency(trace, &mm_stats[i]);
         }
 
 #if 0
@@ -359,6 +592,174 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     }
 }
 
+/*
+ * check_traces_worker - Body of worker process <worker> of run_tests_parallel.
+ *   Checks correctness and utilization of every num_jobs'th trace, each on
+ *   a fresh memlib heap, and writes a trace_result_t for each one to fd.
+ */
+static void check_traces_worker(int worker, int num_tracefiles,
+                                const char *tracedir, char **tracefiles,
+                                int fd)
+{
+    volatile int i;
+
+    /* Pending alarms are not inherited across fork */
+    if (set_timeout > 0)
+        alarm(set_timeout);
+
+    for (i = worker; i < num_tracefiles; i += num_jobs)
+    {
+        trace_result_t result = {i, false, 0.0, 0, 0};
+        stats_t stats;
+
+        mem_init(sparse_mode);
+        range_set_t *volatile ranges = new_range_set();
+        trace_t *trace = read_trace(&stats, tracedir, tracefiles[i]);
+        errors = 0;
+
+        if (setjmp(timeout_jmpbuf) == 0)
+        {
+            /* Do 2 tests, since may fail to reinitialize properly */
+            result.valid = eval_mm_valid(trace, ranges);
+            free_range_set(ranges);
+            ranges = new_range_set();
+            result.valid = result.valid && eval_mm_valid(trace, ranges);
+            if (result.valid)
+            {
+                result.util = eval_mm_util(trace, i, NULL);
+                result.sbrk_calls = mem_sbrk_calls();
+            }
+        }
+        result.errors = errors;
+
+        if (write(fd, &result, sizeof(result)) != sizeof(result))
+            unix_error("write failed in check_traces_worker");
+
+        free_trace(trace);
+        free_range_set(ranges);
+        mem_deinit();
+    }
+}
+
+/*
+ * run_tests_parallel - run_tests with correctness and utilization checked
+ *   by num_jobs worker processes, each with its own memlib heap. Throughput
+ *   is then measured here, one trace at a time after all the workers have
+ *   exited, so that timing is not disturbed by the workers.
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats,
+                               speed_t *speed_params)
+{
+    int fds[2];
+    volatile int i;
+    volatile int num_workers = 0;
+    pid_t *workers;
+    trace_result_t result;
+    bool *checked;
+    sigset_t alarm_set;
+
+    if ((checked = (bool *)calloc(num_tracefiles, sizeof(bool))) == NULL ||
+        (workers = (pid_t *)calloc(num_jobs, sizeof(pid_t))) == NULL)
+        unix_error("calloc failed in run_tests_parallel");
+    if (pipe(fds) < 0)
+        unix_error("pipe failed in run_tests_parallel");
+
+    for (i = 0; i < num_jobs && i < num_tracefiles; i++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+            unix_error("fork failed in run_tests_parallel");
+        if (pid == 0)
+        {
+            close(fds[0]);
+            check_traces_worker(i, num_tracefiles, tracedir, tracefiles,
+                                fds[1]);
+            _exit(0);
+        }
+        workers[num_workers++] = pid;
+    }
+    close(fds[1]);
+
+    if (setjmp(timeout_jmpbuf) != 0)
+    {
+        /* Timed out: traces the workers have not finished are invalid */
+        for (i = 0; i < num_workers; i++)
+            kill(workers[i], SIGKILL);
+    }
+    else
+    {
+        /* Results are small enough that each write arrives whole */
+        while (read(fds[0], &result, sizeof(result)) == sizeof(result))
+        {
+            mm_stats[result.index].valid = result.valid;
+            mm_stats[result.index].util = result.util;
+            mm_stats[result.index].sbrk_calls = result.sbrk_calls;
+            errors += result.errors;
+            checked[result.index] = true;
+        }
+    }
+
+    /*
+     * A timeout from here on must not jump back above, where the workers
+     * would be killed again after they were reaped. Hold it off until the
+     * first trace has set its own jump target.
+     */
+    sigemptyset(&alarm_set);
+    sigaddset(&alarm_set, SIGALRM);
+    sigprocmask(SIG_BLOCK, &alarm_set, NULL);
+    close(fds[0]);
+    while (wait(NULL) > 0)
+        ;
+
+    for (i = 0; i < num_tracefiles; i++)
+    {
+        mem_init(sparse_mode);
+        trace_t *trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
+        range_set_t *ranges = new_range_set();
+
+        if (!checked[i])
+        {
+            /* The worker crashed, exited or timed out on this trace */
+            printf("%s: worker exited before checking the trace\n",
+                   trace->filename);
+            mm_stats[i].valid = false;
+            errors++;
+        }
+
+        /* As in run_tests, a timeout invalidates the trace being timed */
+        if (setjmp(timeout_jmpbuf) != 0)
+        {
+            mm_stats[i].valid = false;
+        }
+        else
+        {
+            sigprocmask(SIG_UNBLOCK, &alarm_set, NULL);
+            if (mm_stats[i].valid)
+            {
+                speed_params->trace = trace;
+                speed_params->ranges = ranges;
+                mm_stats[i].secs = sparse_mode
+                                       ? 1.0
+                                       : time_speed(eval_mm_speed, speed_params);
+                mm_stats[i].tput =
+                    mm_stats[i].ops / (mm_stats[i].secs * 1000.0);
+                if (counter_mode && !sparse_mode)
+                    mm_stats[i].has_counts =
+                        get_fcyc_counts(&mm_stats[i].counts);
+                if (latency_mode && !sparse_mode)
+                    eval_mm_latency(trace, &mm_stats[i]);
+            }
+        }
+
+        free_range_set(ranges);
+        free_trace(trace);
+        mem_deinit();
+    }
+    free(checked);
+    free(workers);
+}
+
 /**************
  * Main routine
  **************/
@@ -383,12 +784,13 @@ int main(int argc, char **argv)
     double max_throughput = -1;
 
 #if !REF_ONLY
+    double bench_throughput = 0; /* If set, benchmark to use (set by -B) */
 
     char c;
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpCOVAlDT")) != EOF)
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:y:B:G:I:M:P:R:U:Y:g:j:hpCOVAlDHLT")) != EOF)
     {
         switch (c)
         {
@@ -441,14 +843,78 @@ int main(int argc, char **argv)
             debug_mode = DBG_EXPENSIVE;
             break;
 
+        case 'I': /* Incremental heap checks, full check every n ops */
+            debug_mode = DBG_INCREMENTAL;
+            full_check_interval = atoi(optarg);
+            break;
+
         case 's':
             set_timeout = atoi(optarg);
             break;
 
+        case 'j': /* Check traces in parallel worker processes */
+            num_jobs = atoi(optarg);
+            break;
+
+        case 'H': /* Print hardware event counts per request */
+            counter_mode = true;
+            break;
+
+        case 'L': /* Print per-request latency percentiles */
+            latency_mode = true;
+            break;
+
+        case 'P': /* Touch the payloads in the speed runs */
+            if (strcmp(optarg, "fill") == 0)
+                touch_mode = TOUCH_FILL;
+            else if (strcmp(optarg, "chase") == 0)
+                touch_mode = TOUCH_CHASE;
+            else if (strcmp(optarg, "both") == 0)
+                touch_mode = TOUCH_BOTH;
+            else
+                app_error("-P takes fill, chase or both, not %s", optarg);
+            break;
+
+        case 'M': /* Replay multithreaded traces on up to n threads */
+            max_threads = atoi(optarg);
+            if (max_threads < 1)
+                app_error("-M needs at least one thread");
+            break;
+
         case 'T':
             tab_mode = true;
             break;
 
+        case 'B': /* Use a fixed benchmark throughput */
+            bench_throughput = atof(optarg);
+            break;
+
+        case 'R': /* Write a machine-readable report */
+            report_file = optarg;
+            break;
+
+        case 'G': /* Check for regressions against an earlier report */
+            baseline_file = optarg;
+            break;
+
+        case 'g': /* Regression threshold in percent */
+            regress_threshold = atof(optarg);
+            break;
+
+        case 'Y': /* Write heap snapshots */
+            if ((snapshot_fp = fopen(optarg, "w")) == NULL)
+                unix_error("Could not open %s for snapshots", optarg);
+            break;
+
+        case 'y': /* Requests after which to take snapshots */
+            parse_snapshot_ops(optarg);
+            break;
+
+        case 'U': /* Write the utilization timeline of each trace */
+            if ((timeline_fp = fopen(optarg, "w")) == NULL)
+                unix_error("Could not open %s for the timeline", optarg);
+            break;
+
         case 'h': /* Print this message */
             usage(argv[0]);
             exit(0);
@@ -476,6 +942,19 @@ int main(int argc, char **argv)
     {
         init_random_data();
     }
+#if !COMPARE_MODE
+    /* Have the package's own contracts check only the touched blocks too */
+    if (debug_mode == DBG_INCREMENTAL && mm_set_incremental_checks != NULL)
+        mm_set_incremental_checks(true);
+#endif
+
+    /* Hardware counters are a bonus; run without them if we can't have them */
+    if (counter_mode && !set_fcyc_counters(1))
+    {
+        fprintf(stderr, "Hardware counters unavailable (%s), ignoring -H\n",
+                fcyc_counters_error());
+        counter_mode = false;
+    }
 
     /* Initialize the timeout */
     if (set_timeout > 0)
@@ -511,7 +990,13 @@ int main(int argc, char **argv)
                 speed_params.trace = trace;
                 if (verbose > 1)
                     printf("and performance.\n");
-                libc_stats[i].secs = fsec(eval_libc_speed, &speed_params);
+                libc_stats[i].secs =
+                    time_speed(eval_libc_speed, &speed_params);
+                libc_stats[i].tput =
+                    libc_stats[i].ops / (libc_stats[i].secs * 1000.0);
+                if (counter_mode)
+                    libc_stats[i].has_counts =
+                        get_fcyc_counts(&libc_stats[i].counts);
             }
             free_trace(trace);
         }
@@ -523,6 +1008,8 @@ int main(int argc, char **argv)
             printf("\nResults for libc malloc:\n");
             printresults(num_global_tracefiles, libc_stats,
                          &global_libc_sum_stats);
+            if (counter_mode)
+                printcounters(num_global_tracefiles, libc_stats);
         }
     }
 
@@ -530,7 +1017,9 @@ int main(int argc, char **argv)
     /*
      * Get benchmark throughput
      */
-    double ref_throughput = measure_ref_throughput(checkpoint);
+    double ref_throughput = bench_throughput > 0
+                                ? bench_throughput
+                                : measure_ref_throughput(checkpoint);
 
     min_throughput = ref_throughput * (checkpoint ? MIN_SPEED_RATIO_CHECKPOINT
                                                   : MIN_SPEED_RATIO);
@@ -559,6 +1048,43 @@ int main(int argc, char **argv)
     run_tests(num_global_tracefiles, tracedir, global_tracefiles, mm_stats,
               &speed_params);
 
+#if COMPARE_MODE
+    /*
+     * Run the other packages on the same traces. Their errors are
+     * reported in their own tables but do not count against mm.c.
+     */
+    stats_t *cmp_stats[NUM_ALLOCATORS];
+    sum_stats_t cmp_sum_stats[NUM_ALLOCATORS];
+    int mm_errors = errors;
+
+    cmp_stats[0] = mm_stats;
+    for (i = 1; i < NUM_ALLOCATORS; i++)
+    {
+        cur_allocator = &allocators[i];
+        errors = 0;
+        if (verbose > 1)
+            printf("\nTesting %s malloc\n", cur_allocator->name);
+
+        cmp_stats[i] = (stats_t *)calloc(num_global_tracefiles, sizeof(stats_t));
+        if (cmp_stats[i] == NULL)
+            unix_error("cmp_stats calloc in main failed");
+
+        run_tests(num_global_tracefiles, tracedir, global_tracefiles,
+                  cmp_stats[i], &speed_params);
+
+        printf("\nResults for %s malloc:\n", cur_allocator->name);
+        printresults(num_global_tracefiles, cmp_stats[i], &cmp_sum_stats[i]);
+        if (latency_mode)
+            printlatency(num_global_tracefiles, cmp_stats[i]);
+        if (counter_mode)
+            printcounters(num_global_tracefiles, cmp_stats[i]);
+        if (timeline_fp != NULL)
+            printtimeline(num_global_tracefiles, cmp_stats[i]);
+    }
+    cur_allocator = &allocators[0];
+    errors = mm_errors;
+#endif
+
     /* Display the mm results in a compact table */
     if (verbose)
     {
@@ -582,6 +1108,25 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (latency_mode)
+            {
+                printlatency(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (counter_mode)
+            {
+                printcounters(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (timeline_fp != NULL)
+            {
+                printtimeline(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+#if COMPARE_MODE
+            printcomparison(num_global_tracefiles, cmp_stats);
+            printf("\n");
+#endif
         }
     }
 
@@ -595,6 +1140,11 @@ int main(int argc, char **argv)
                (float)(global_mm_sum_stats.tput / global_libc_sum_stats.tput));
     }
 
+    /* Optionally replay the multithreaded traces concurrently */
+    if (max_threads > 0)
+        run_scaling(num_global_tracefiles, tracedir, global_tracefiles,
+                    run_libc);
+
     /* temporaries used to compute the performance index */
     double avg_mm_util = 0.0;
     double avg_mm_harm_throughput = 0.0;
@@ -727,6 +1277,40 @@ int main(int argc, char **argv)
         printf("Terminated with %d errors\n", errors);
     }
 
+    /*
+     * Optionally write a report of every allocator that was run, and check
+     * it against a baseline
+     */
+    int regressions = 0;
+    if (report_file != NULL || baseline_file != NULL)
+    {
+        const char *names[NUM_ALLOCATORS + 1];
+        stats_t *all_stats[NUM_ALLOCATORS + 1];
+        int num_allocs = 0;
+
+#if COMPARE_MODE
+        for (i = 0; i < NUM_ALLOCATORS; i++)
+        {
+            names[num_allocs] = allocators[i].name;
+            all_stats[num_allocs++] = cmp_stats[i];
+        }
+#else
+        names[num_allocs] = "mm";
+        all_stats[num_allocs++] = mm_stats;
+#endif
+        if (run_libc)
+        {
+            names[num_allocs] = "libc";
+            all_stats[num_allocs++] = libc_stats;
+        }
+        if (report_file != NULL)
+            write_report(report_file, num_global_tracefiles, num_allocs, names,
+                         all_stats);
+        if (baseline_file != NULL)
+            regressions = check_baseline(baseline_file, num_global_tracefiles,
+                                         num_allocs, names, all_stats);
+    }
+
     /* Optionally emit autoresult string */
     double score = checkpoint ? perfindex_checkpoint : perfindex;
     /* Scoreboard shows: score, deductions, throughput, utilization */
@@ -754,7 +1338,11 @@ int main(int argc, char **argv)
                 avg_mm_harm_throughput, avg_mm_util * 100);
         printf("%s\n", autoresult);
     }
-    exit(0);
+    if (timeline_fp != NULL)
+        fclose(timeline_fp);
+    if (snapshot_fp != NULL)
+        fclose(snapshot_fp);
+    exit(regressions > 0 ? 1 : 0);
 }
 
 /*****************************************************************
@@ -944,6 +1532,19 @@ static void randomize_block(trace_t *traces, int index)
 #endif
 }
 
+/*
+ * check_heap_incremental - Have the package check the blocks touched since
+ * the last check, or the whole heap if it cannot do that
+ */
+static bool check_heap_incremental(void)
+{
+#if !COMPARE_MODE
+    if (mm_checkheap_incremental == NULL)
+        return mm_checkheap(0);
+#endif
+    return mm_checkheap_incremental(0);
+}
+
 static bool check_index(const trace_t *trace, int opnum, int index)
 {
     size_t size, fsize;
@@ -1006,71 +1607,102 @@ static bool check_index(const trace_t *trace, int opnum, int index)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * map_binary_trace - If tracefile is a binary trace, map its requests in
+ * as trace->ops and fill in the header fields. Returns false if it is a
+ * text trace.
  */
-static trace_t *read_trace(stats_t *stats, const char *tracedir,
-                           const char *filename)
+static bool map_binary_trace(trace_t *trace, FILE *tracefile)
+{
+    bintrace_header_t header;
+    struct stat st;
+    size_t len;
+    void *map;
+
+    if (fread(&header, sizeof(header), 1, tracefile) != 1 ||
+        memcmp(header.magic, BINTRACE_MAGIC, sizeof(header.magic)) != 0)
+        return false;
+
+    if (header.num_ops < 0 || header.num_ids <= 0)
+        app_error("%s: bad binary trace header", trace->filename);
+    len = sizeof(header) + (size_t)header.num_ops * sizeof(traceop_t);
+    if (fstat(fileno(tracefile), &st) < 0)
+        unix_error("fstat failed in read_trace");
+    if ((size_t)st.st_size < len)
+        app_error("%s: truncated binary trace", trace->filename);
+
+    map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(tracefile), 0);
+    if (map == MAP_FAILED)
+        unix_error("mmap failed in read_trace");
+
+    trace->weight = header.weight;
+    trace->num_ids = header.num_ids;
+    trace->num_ops = header.num_ops;
+    trace->data_bytes = header.data_bytes;
+    trace->ops = (traceop_t *)((char *)map + sizeof(header));
+    trace->map = map;
+    trace->map_len = len;
+
+    /* Reject what parse_text_trace would, before anything indexes by it */
+    for (int i = 0; i < trace->num_ops; i++)
+    {
+        traceop_t *op = &trace->ops[i];
+        if (op->type != ALLOC && op->type != FREE && op->type != REALLOC)
+            app_error("Bogus type (%d) in request %d of tracefile %s\n",
+                      (int)op->type, i, trace->filename);
+        if (op->index < 0 || op->index >= trace->num_ids)
+            app_error("Bogus index (%d) in request %d of tracefile %s\n",
+                      op->index, i, trace->filename);
+    }
+    return true;
+}
+
+/*
+ * parse_text_trace - Read the header and requests of a text trace
+ */
+static void parse_text_trace(trace_t *trace, FILE *tracefile)
 {
-    FILE *tracefile;
-    trace_t *trace;
     char type[MAXLINE];
     int index;
     size_t size;
     int max_index = 0;
     int op_index;
+    int thread;
     int ignore = 0;
 
-    if (verbose > 1)
-        printf("Reading tracefile: %s\n", filename);
-
-    /* Allocate the trace record */
-    if ((trace = (trace_t *)malloc(sizeof(trace_t))) == NULL)
-        unix_error("malloc 1 failed in read_trace");
-
-    /* Read the trace file header */
-    strcpy(trace->filename, tracedir);
-    strcat(trace->filename, filename);
-    if ((tracefile = fopen(trace->filename, "r")) == NULL)
-    {
-        unix_error("Could not open %s in read_trace", trace->filename);
-    }
     int iweight;
     ignore += fscanf(tracefile, "%d", &iweight);
     trace->weight = iweight;
     ignore += fscanf(tracefile, "%d", &trace->num_ids);
     ignore += fscanf(tracefile, "%d", &trace->num_ops);
     ignore += fscanf(tracefile, "%zd", &trace->data_bytes);
-
-    if (trace->weight > 3)
-    {
-        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
-    }
+    trace->map = NULL;
 
     /* We'll store each request line in the trace in this array */
     if ((trace->ops =
              (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
         unix_error("malloc 2 failed in read_trace");
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = (char **)calloc(trace->num_ids, sizeof(char *))) ==
-        NULL)
-        unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes =
-             (size_t *)calloc(trace->num_ids, sizeof(size_t))) == NULL)
-        unix_error("malloc 4 failed in read_trace");
-
-    /* and, if we're debugging, the offset into the random data */
-    if ((trace->block_rand_base =
-             calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
-        unix_error("malloc 5 failed in read_trace");
-
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF)
     {
+        /* A request may be prefixed with the thread making it, as in t2 */
+        if (type[0] == 't')
+        {
+            if (sscanf(type + 1, "%d", &thread) != 1 || thread < 0)
+                app_error("Bogus thread id (%s) in tracefile %s", type,
+                          trace->filename);
+            if (trace->threads == NULL &&
+                (trace->threads = calloc(trace->num_ops, sizeof(int))) ==
+                    NULL)
+                unix_error("malloc 6 failed in read_trace");
+            trace->threads[op_index] = thread;
+            if (thread >= trace->num_threads)
+                trace->num_threads = thread + 1;
+            ignore += fscanf(tracefile, "%s", type);
+        }
+
         switch (type[0])
         {
         case 'a':
@@ -1100,38 +1732,102 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
         if (op_index == trace->num_ops)
             break;
     }
-    fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
-
-    /* fill in the stats */
-    strcpy(stats->filename, trace->filename);
-    stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
-
-    return trace;
 }
 
 /*
- * reinit_trace - get the trace ready for another run.
+ * read_trace - read a trace file and store it in memory
  */
-static void reinit_trace(trace_t *trace)
+static trace_t *read_trace(stats_t *stats, const char *tracedir,
+                           const char *filename)
 {
-    memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
-    memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
-    /* block_rand_base is unused if size is zero */
-}
+    FILE *tracefile;
+    trace_t *trace;
 
-/*
- * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
- */
-static void free_trace(trace_t *trace)
-{
-    free(trace->ops); /* free the three arrays... */
-    free(trace->blocks);
-    free(trace->block_sizes);
+    if (verbose > 1)
+    {
+        printf("Reading tracefile: %s\n", filename);
+        start_timer();
+    }
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *)malloc(sizeof(trace_t))) == NULL)
+        unix_error("malloc 1 failed in read_trace");
+
+    /* Read the trace file header and requests */
+    strcpy(trace->filename, tracedir);
+    strcat(trace->filename, filename);
+    if ((tracefile = fopen(trace->filename, "r")) == NULL)
+    {
+        unix_error("Could not open %s in read_trace", trace->filename);
+    }
+    trace->threads = NULL;
+    trace->num_threads = 1;
+    if (!map_binary_trace(trace, tracefile))
+    {
+        rewind(tracefile);
+        parse_text_trace(trace, tracefile);
+    }
+    fclose(tracefile);
+
+    if (trace->weight > 3)
+    {
+        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
+    }
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = (char **)calloc(trace->num_ids, sizeof(char *))) ==
+        NULL)
+        unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes =
+             (size_t *)calloc(trace->num_ids, sizeof(size_t))) == NULL)
+        unix_error("malloc 4 failed in read_trace");
+
+    /* and, if we're debugging, the offset into the random data */
+    if ((trace->block_rand_base =
+             calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
+        unix_error("malloc 5 failed in read_trace");
+
+    if (verbose > 1)
+        printf("Read %d requests in %.3f ms (%s)\n", trace->num_ops,
+               get_timer() * 1e3,
+               trace->map != NULL ? "binary" : "text");
+
+    /* fill in the stats */
+    strcpy(stats->filename, trace->filename);
+    stats->weight = trace->weight;
+    stats->ops = trace->num_ops;
+
+    return trace;
+}
+
+/*
+ * reinit_trace - get the trace ready for another run.
+ */
+static void reinit_trace(trace_t *trace)
+{
+    memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
+    memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
+    /* block_rand_base is unused if size is zero */
+}
+
+/*
+ * free_trace - Free the trace record and the four arrays it points
+ *              to, all of which were allocated in read_trace().
+ */
+static void free_trace(trace_t *trace)
+{
+    if (trace->map != NULL) /* free the three arrays... */
+        munmap(trace->map, trace->map_len);
+    else
+        free(trace->ops);
+    free(trace->blocks);
+    free(trace->block_sizes);
     free(trace->block_rand_base);
+    free(trace->threads);
     free(trace); /* and the trace record itself... */
 }
 
@@ -1170,7 +1866,24 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
         index = trace->ops[i].index;
         size = trace->ops[i].size;
 
-        if (debug_mode == DBG_EXPENSIVE)
+        bool full_check = debug_mode == DBG_EXPENSIVE;
+        if (debug_mode == DBG_INCREMENTAL)
+        {
+            /*
+             * Check the touched blocks even before a full check, so the
+             * package's record of them starts afresh for this operation.
+             */
+            full_check =
+                full_check_interval > 0 && i % full_check_interval == 0;
+            if (!check_heap_incremental())
+            {
+                malloc_error(trace, i,
+                             "mm_checkheap_incremental returned false\n");
+                return false;
+            }
+        }
+
+        if (full_check)
         {
             range_t *r;
 
@@ -1302,6 +2015,161 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     return allCheck;
 }
 
+/*
+ * write_timeline_sample - Append one row to the -U timeline: live payload
+ *    bytes, heap size and, if the allocator reports them, the free bytes in
+ *    each of its size classes after request op of a trace. The header is
+ *    written with the first row, and sets the number of class columns.
+ */
+static void write_timeline_sample(const trace_t *trace, int op, size_t live)
+{
+    static int header_classes = -1;
+    size_t bytes[TIMELINE_MAX_CLASSES];
+    size_t free_bytes = 0;
+    int num_classes = 0;
+    int c;
+
+#if COMPARE_MODE
+    const char *name = cur_allocator->name;
+    if (cur_allocator->seglist_free_bytes != NULL)
+        num_classes =
+            cur_allocator->seglist_free_bytes(bytes, TIMELINE_MAX_CLASSES);
+#else
+    const char *name = "mm";
+    if (mm_seglist_free_bytes != NULL)
+        num_classes = mm_seglist_free_bytes(bytes, TIMELINE_MAX_CLASSES);
+#endif
+
+    if (header_classes < 0)
+    {
+        header_classes = num_classes;
+        fprintf(timeline_fp, "allocator,trace,op,live_bytes,heap_bytes,"
+                             "free_bytes");
+        for (c = 0; c < header_classes; c++)
+            fprintf(timeline_fp, ",class%d", c);
+        fprintf(timeline_fp, "\n");
+    }
+
+    for (c = 0; c < num_classes; c++)
+        free_bytes += bytes[c];
+    fprintf(timeline_fp, "%s,%s,%d,%zu,%zu,", name,
+            trace_basename(trace->filename), op, live, mem_heapsize());
+    if (num_classes > 0)
+        fprintf(timeline_fp, "%zu", free_bytes);
+    for (c = 0; c < header_classes; c++)
+    {
+        if (c < num_classes)
+            fprintf(timeline_fp, ",%zu", bytes[c]);
+        else
+            fprintf(timeline_fp, ",");
+    }
+    fprintf(timeline_fp, "\n");
+}
+
+/*
+ * Heap snapshots (-Y) are appended to the snapshot file one after another,
+ * and read by heapmap.pl. Each is a header, the trace name padded with
+ * nulls to a multiple of 8 bytes, and one record per block in address
+ * order, all in the byte order of this machine.
+ */
+#define SNAPSHOT_MAGIC "MMSNAP01"
+#define SNAPSHOT_ALLOC 0xff /* class byte of an allocated block */
+
+typedef struct
+{
+    char magic[8];       /* SNAPSHOT_MAGIC, without the terminating null */
+    uint32_t op;         /* request after which it was taken */
+    uint32_t name_len;   /* length of the trace name */
+    uint64_t heap_size;  /* mem_heapsize() */
+    uint64_t num_blocks; /* number of records that follow */
+} snapshot_header_t;
+
+typedef struct
+{
+    uint64_t offset; /* of the block's header from the start of the heap */
+    uint64_t info;   /* size << 8 | free list class, or SNAPSHOT_ALLOC */
+} snapshot_block_t;
+
+_Static_assert(sizeof(snapshot_header_t) == 32 &&
+                   sizeof(snapshot_block_t) == 16,
+               "snapshot records must match heapmap.pl");
+
+/* parse_snapshot_ops - Read the comma-separated request numbers of -y */
+static void parse_snapshot_ops(const char *list)
+{
+    const char *p = list;
+    char *end;
+    int n = 1;
+
+    for (; *p != '\0'; p++)
+        n += (*p == ',');
+    if ((snapshot_ops = realloc(snapshot_ops, n * sizeof(int))) == NULL)
+        unix_error("realloc failed in parse_snapshot_ops");
+    for (p = list, num_snapshot_ops = 0; num_snapshot_ops < n; p = end + 1)
+    {
+        long op = strtol(p, &end, 10);
+        if (end == p || op < 0 || (*end != ',' && *end != '\0'))
+            app_error("-y takes request numbers separated by commas");
+        if (num_snapshot_ops > 0 && op <= snapshot_ops[num_snapshot_ops - 1])
+            app_error("-y request numbers must be increasing");
+        snapshot_ops[num_snapshot_ops++] = (int)op;
+    }
+}
+
+/* snapshot_visit - Write one block of a snapshot; called by mm_walk_heap */
+static void snapshot_visit(void *arg, size_t offset, size_t size, bool alloc,
+                           int seglist)
+{
+    snapshot_block_t rec;
+    uint64_t *count = (uint64_t *)arg;
+
+    rec.offset = offset;
+    rec.info = (uint64_t)size << 8 |
+               (alloc ? SNAPSHOT_ALLOC
+                      : (seglist < SNAPSHOT_ALLOC ? seglist
+                                                  : SNAPSHOT_ALLOC - 1));
+    fwrite(&rec, sizeof(rec), 1, snapshot_fp);
+    (*count)++;
+}
+
+/*
+ * write_heap_snapshot - Append a snapshot of the heap after request op of
+ *    a trace, if the allocator can walk its heap. The block count is
+ *    filled in once the blocks have been written.
+ */
+static void write_heap_snapshot(const trace_t *trace, int op)
+{
+    static const char pad[8];
+    const char *name = trace_basename(trace->filename);
+    snapshot_header_t header;
+    off_t start;
+
+#if COMPARE_MODE
+    void (*walk)(mm_visit_t, void *) = cur_allocator->walk_heap;
+#else
+    void (*walk)(mm_visit_t, void *) = mm_walk_heap;
+#endif
+    if (walk == NULL)
+        return;
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.op = op;
+    header.name_len = (uint32_t)strlen(name);
+    header.heap_size = mem_heapsize();
+    header.num_blocks = 0;
+
+    start = ftello(snapshot_fp);
+    fwrite(&header, sizeof(header), 1, snapshot_fp);
+    fwrite(name, 1, header.name_len, snapshot_fp);
+    fwrite(pad, 1, -header.name_len % 8, snapshot_fp);
+    walk(snapshot_visit, &header.num_blocks);
+
+    if (fseeko(snapshot_fp, start, SEEK_SET) < 0 ||
+        fwrite(&header, sizeof(header), 1, snapshot_fp) != 1 ||
+        fseeko(snapshot_fp, 0, SEEK_END) < 0)
+        unix_error("Could not write a heap snapshot");
+}
+
 /*
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
@@ -1314,7 +2182,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, double *time_util)
 {
     int i;
     int index;
@@ -1323,6 +2191,10 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     size_t total_size = 0;
     char *p;
     char *newp, *oldp;
+    double util_sum = 0.0;
+    int util_ops = 0;
+    int sample_every = trace->num_ops / TIMELINE_SAMPLES + 1;
+    int next_snapshot = 0;
 
     reinit_trace(trace);
 
@@ -1400,8 +2272,32 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size =
             (total_size > max_total_size) ? total_size : max_total_size;
+
+        /* and the running average of the current utilization */
+        if (mem_heapsize() > 0)
+        {
+            util_sum += (double)total_size / (double)mem_heapsize();
+            util_ops++;
+        }
+        if (timeline_fp != NULL &&
+            (i % sample_every == 0 || i == trace->num_ops - 1))
+            write_timeline_sample(trace, i, total_size);
+
+        if (snapshot_fp != NULL)
+        {
+            while (next_snapshot < num_snapshot_ops &&
+                   snapshot_ops[next_snapshot] < i)
+                next_snapshot++;
+            if (i == trace->num_ops - 1 ||
+                (next_snapshot < num_snapshot_ops &&
+                 snapshot_ops[next_snapshot] == i))
+                write_heap_snapshot(trace, i);
+        }
     }
 
+    if (time_util != NULL)
+        *time_util = util_ops > 0 ? util_sum / util_ops : 0.0;
+
 #if !REF_ONLY
     printf(".");
 #endif
@@ -1409,6 +2305,179 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     return ((double)max_total_size / (double)mem_heapsize());
 }
 
+/* Where the speed runs leave what they read from the payloads */
+static volatile uintptr_t sink;
+
+/*
+ * Payload access during the speed runs (-P). With fill, every payload is
+ * written in full when it is allocated (and grown by realloc), and one
+ * word of each cache line is read back before it is freed. With chase,
+ * the live blocks of at least CHASE_MIN bytes form a doubly linked list
+ * kept in their first two words, newest first, the way programs keep
+ * their objects on intrusive lists; after every request CHASE_HOPS links
+ * are followed from a roving cursor. Either way the measured throughput
+ * includes the cache and TLB misses caused by where the allocator put the
+ * blocks.
+ */
+#define TOUCH_LINE 64
+#define CHASE_MIN (2 * sizeof(char *))
+#define CHASE_HOPS 8
+
+/* The list of live blocks for chase */
+typedef struct
+{
+    char *head;
+    char *cursor;
+    uintptr_t sink; /* keeps the loads from being optimized away */
+} touch_t;
+
+#define CHASE_NEXT(p) (((char **)(p))[0])
+#define CHASE_PREV(p) (((char **)(p))[1])
+
+static void touch_link(touch_t *t, char *p)
+{
+    CHASE_NEXT(p) = t->head;
+    CHASE_PREV(p) = NULL;
+    if (t->head != NULL)
+        CHASE_PREV(t->head) = p;
+    t->head = p;
+    if (t->cursor == NULL)
+        t->cursor = p;
+}
+
+static void touch_unlink(touch_t *t, char *p)
+{
+    char *next = CHASE_NEXT(p), *prev = CHASE_PREV(p);
+    if (prev != NULL)
+        CHASE_NEXT(prev) = next;
+    else
+        t->head = next;
+    if (next != NULL)
+        CHASE_PREV(next) = prev;
+    if (t->cursor == p)
+        t->cursor = next != NULL ? next : t->head;
+}
+
+/* A linked block moved from oldp to newp, links and all */
+static void touch_moved(touch_t *t, char *oldp, char *newp)
+{
+    char *next = CHASE_NEXT(newp), *prev = CHASE_PREV(newp);
+    if (prev != NULL)
+        CHASE_NEXT(prev) = newp;
+    else
+        t->head = newp;
+    if (next != NULL)
+        CHASE_PREV(next) = newp;
+    if (t->cursor == oldp)
+        t->cursor = newp;
+}
+
+static void touch_walk(touch_t *t)
+{
+    char *p = t->cursor;
+    int hop;
+
+    if (p == NULL)
+        return;
+    for (hop = 0; hop < CHASE_HOPS; hop++)
+    {
+        p = CHASE_NEXT(p) != NULL ? CHASE_NEXT(p) : t->head;
+        t->sink += (uintptr_t)CHASE_PREV(p);
+    }
+    t->cursor = p;
+}
+
+/* Called after p got size bytes: from malloc (oldsize 0) or realloc */
+static void touch_alloc(touch_t *t, char *oldp, char *p, size_t oldsize,
+                        size_t size)
+{
+    if ((touch_mode & TOUCH_FILL) && size > oldsize)
+        memset(p + oldsize, 0x5a, size - oldsize);
+    if (touch_mode & TOUCH_CHASE)
+    {
+        if (oldsize >= CHASE_MIN && size >= CHASE_MIN)
+            touch_moved(t, oldp, p);
+        else if (size >= CHASE_MIN)
+            touch_link(t, p);
+        touch_walk(t);
+    }
+}
+
+/* Called before p of size bytes is freed, or reallocated to newsize */
+static void touch_free(touch_t *t, char *p, size_t size, size_t newsize)
+{
+    size_t i;
+
+    if (touch_mode & TOUCH_FILL)
+        for (i = 0; i < size; i += TOUCH_LINE)
+            t->sink += (unsigned char)p[i];
+    if ((touch_mode & TOUCH_CHASE) && size >= CHASE_MIN && newsize < CHASE_MIN)
+        touch_unlink(t, p);
+}
+
+/*
+ * touch_request - Use the payloads around request i of a trace. Called
+ *    with after false before the request is made, and with after true
+ *    once the new block (if any) is in trace->blocks.
+ */
+static void touch_request(touch_t *t, trace_t *trace, int i, bool after,
+                          char *oldp)
+{
+    int index = trace->ops[i].index;
+    size_t size = trace->ops[i].size;
+
+    if (index < 0)
+        return;
+    switch (trace->ops[i].type)
+    {
+    case ALLOC:
+        if (after)
+        {
+            touch_alloc(t, NULL, trace->blocks[index], 0, size);
+            trace->block_sizes[index] = size;
+        }
+        break;
+    case REALLOC:
+        if (!after)
+            touch_free(t, trace->blocks[index], trace->block_sizes[index],
+                       size);
+        else
+        {
+            touch_alloc(t, oldp, trace->blocks[index],
+                        trace->block_sizes[index], size);
+            trace->block_sizes[index] = size;
+        }
+        break;
+    case FREE:
+        if (!after)
+            touch_free(t, trace->blocks[index], trace->block_sizes[index], 0);
+        break;
+    }
+}
+
+/*
+ * time_speed - Time f with fsec, or, when writing or checking a report,
+ * return the median of REPORT_SPEED_RUNS timings
+ */
+static double time_speed(test_funct f, void *params)
+{
+    double secs[REPORT_SPEED_RUNS];
+    int runs = report_file != NULL || baseline_file != NULL
+                   ? REPORT_SPEED_RUNS
+                   : 1;
+    int i, j;
+
+    for (i = 0; i < runs; i++)
+    {
+        double s = fsec(f, params);
+        /* Insertion sort */
+        for (j = i; j > 0 && secs[j - 1] > s; j--)
+            secs[j] = secs[j - 1];
+        secs[j] = s;
+    }
+    return secs[runs / 2];
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
@@ -1419,6 +2488,7 @@ static void eval_mm_speed(void *ptr)
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    touch_t touch = {NULL, NULL, 0};
     reinit_trace(trace);
 
     /* Reset the heap and initialize the mm package */
@@ -1428,6 +2498,12 @@ static void eval_mm_speed(void *ptr)
 
     /* Interpret each trace request */
     for (i = 0; i < trace->num_ops; i++)
+    {
+        oldp = trace->ops[i].index < 0 ? NULL
+                                       : trace->blocks[trace->ops[i].index];
+        if (touch_mode != TOUCH_NONE)
+            touch_request(&touch, trace, i, false, oldp);
+
         switch (trace->ops[i].type)
         {
 
@@ -1466,6 +2542,441 @@ static void eval_mm_speed(void *ptr)
         default:
             app_error("Nonexistent request type in eval_mm_speed");
         }
+
+        if (touch_mode != TOUCH_NONE)
+            touch_request(&touch, trace, i, true, oldp);
+    }
+    sink = touch.sink;
+}
+
+/**********************************************************************
+ * Multithreaded replay (-M). Each thread of a trace replays its own
+ * requests on a pthread. Requests on the same block still happen in
+ * trace order: a request waits until the previous request on its block,
+ * possibly made by another thread, is done. Every wait is for an earlier
+ * request, so the replay cannot deadlock.
+ **********************************************************************/
+
+/* Replays of each thread count, of which the fastest is reported */
+#define MT_RUNS 3
+
+/* State shared by the threads replaying a trace */
+typedef struct
+{
+    trace_t *trace;
+    int *prev;              /* previous request on the same block, or -1 */
+    unsigned char *done;    /* set once a request has been made */
+    bool libc;              /* use libc malloc instead of mm */
+    pthread_mutex_t lock;   /* serializes the calls into mm */
+    pthread_barrier_t ready; /* all threads are up... */
+    pthread_barrier_t start; /* ... and the clock is running */
+} mt_replay_t;
+
+/* One replaying thread */
+typedef struct
+{
+    mt_replay_t *replay;
+    int *ops;    /* the requests it makes, in trace order */
+    int num_ops;
+    pthread_t tid;
+} mt_worker_t;
+
+/*
+ * mt_replay_thread - Make one thread's requests. mm.c is not thread-safe,
+ *    so its calls are serialized with a lock; libc is called directly.
+ */
+static void *mt_replay_thread(void *arg)
+{
+    mt_worker_t *worker = (mt_worker_t *)arg;
+    mt_replay_t *replay = worker->replay;
+    trace_t *trace = replay->trace;
+    int i, j, index;
+    size_t size;
+    char *p;
+
+    pthread_barrier_wait(&replay->ready);
+    pthread_barrier_wait(&replay->start);
+    for (j = 0; j < worker->num_ops; j++)
+    {
+        i = worker->ops[j];
+        if (replay->prev[i] >= 0)
+            while (!__atomic_load_n(&replay->done[replay->prev[i]],
+                                    __ATOMIC_ACQUIRE))
+                sched_yield();
+
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if (!replay->libc)
+            pthread_mutex_lock(&replay->lock);
+        switch (trace->ops[i].type)
+        {
+        case ALLOC:
+            p = replay->libc ? malloc(size) : mm_malloc(size);
+            if (p == NULL)
+                app_error("malloc error in mt_replay_thread");
+            trace->blocks[index] = p;
+            break;
+
+        case REALLOC:
+            if (replay->libc)
+                p = realloc(trace->blocks[index], size);
+            else
+            {
+                /* memlib's UB check flag is shared, so only under the lock */
+                setUBCheck(false);
+                p = mm_realloc(trace->blocks[index], size);
+                setUBCheck(true);
+            }
+            if (p == NULL && size != 0)
+                app_error("realloc error in mt_replay_thread");
+            trace->blocks[index] = p;
+            break;
+
+        case FREE:
+            p = index < 0 ? NULL : trace->blocks[index];
+            if (replay->libc)
+                free(p);
+            else
+                mm_free(p);
+            break;
+
+        default:
+            app_error("Nonexistent request type in mt_replay_thread");
+        }
+        if (!replay->libc)
+            pthread_mutex_unlock(&replay->lock);
+        __atomic_store_n(&replay->done[i], 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * eval_mt_speed - Replay a trace with its threads spread round-robin over
+ *    num_workers pthreads, and return the best of MT_RUNS wall-clock times
+ */
+static double eval_mt_speed(trace_t *trace, int num_workers, bool libc)
+{
+    mt_replay_t replay;
+    mt_worker_t *workers;
+    int *last, *order;
+    int i, w, run, index;
+    struct timespec t0, t1;
+    double secs, best = DBL_MAX;
+
+    replay.trace = trace;
+    replay.libc = libc;
+    replay.prev = malloc(trace->num_ops * sizeof(int));
+    replay.done = malloc(trace->num_ops);
+    last = malloc(trace->num_ids * sizeof(int));
+    order = malloc(trace->num_ops * sizeof(int));
+    workers = calloc(num_workers, sizeof(mt_worker_t));
+    if (replay.prev == NULL || replay.done == NULL || last == NULL ||
+        order == NULL || workers == NULL)
+        unix_error("malloc failed in eval_mt_speed");
+
+    /* Chain the requests on each block, and deal them out to the workers */
+    for (i = 0; i < trace->num_ids; i++)
+        last[i] = -1;
+    for (i = 0; i < trace->num_ops; i++)
+    {
+        index = trace->ops[i].index;
+        replay.prev[i] = index < 0 ? -1 : last[index];
+        if (index >= 0)
+            last[index] = i;
+        w = trace->threads != NULL ? trace->threads[i] % num_workers : 0;
+        workers[w].num_ops++;
+    }
+    for (w = 0, i = 0; w < num_workers; w++)
+    {
+        workers[w].replay = &replay;
+        workers[w].ops = order + i;
+        i += workers[w].num_ops;
+        workers[w].num_ops = 0;
+    }
+    for (i = 0; i < trace->num_ops; i++)
+    {
+        w = trace->threads != NULL ? trace->threads[i] % num_workers : 0;
+        workers[w].ops[workers[w].num_ops++] = i;
+    }
+
+    pthread_mutex_init(&replay.lock, NULL);
+    for (run = 0; run < MT_RUNS; run++)
+    {
+        reinit_trace(trace);
+        memset(replay.done, 0, trace->num_ops);
+        if (!libc)
+        {
+            mem_reset_brk();
+            if (!mm_init())
+                app_error("mm_init failed in eval_mt_speed");
+        }
+
+        pthread_barrier_init(&replay.ready, NULL, num_workers + 1);
+        pthread_barrier_init(&replay.start, NULL, num_workers + 1);
+        for (w = 0; w < num_workers; w++)
+            if ((errno = pthread_create(&workers[w].tid, NULL,
+                                        mt_replay_thread, &workers[w])) != 0)
+                unix_error("pthread_create failed in eval_mt_speed");
+        pthread_barrier_wait(&replay.ready);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        pthread_barrier_wait(&replay.start);
+        for (w = 0; w < num_workers; w++)
+            pthread_join(workers[w].tid, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        pthread_barrier_destroy(&replay.ready);
+        pthread_barrier_destroy(&replay.start);
+
+        secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+        best = secs < best ? secs : best;
+
+        /* libc keeps what we don't give back */
+        if (libc)
+            for (i = 0; i < trace->num_ids; i++)
+                if (last[i] >= 0 && trace->ops[last[i]].type != FREE)
+                    free(trace->blocks[i]);
+    }
+    pthread_mutex_destroy(&replay.lock);
+
+    free(replay.prev);
+    free(replay.done);
+    free(last);
+    free(order);
+    free(workers);
+    return best;
+}
+
+/*
+ * run_scaling - Replay every multithreaded trace with 1, 2, 4, ... threads,
+ *    up to the number in the trace or max_threads, and print the aggregate
+ *    throughput and the speedup over one thread for mm (and libc)
+ */
+static void run_scaling(int num_tracefiles, const char *tracedir,
+                        char **tracefiles, bool run_libc)
+{
+    int num_cols = NUM_ALLOCATORS + (run_libc ? 1 : 0);
+    double base[NUM_ALLOCATORS + 1];
+    stats_t stats;
+    trace_t *trace;
+    int i, k, col, limit;
+
+    for (i = 0; i < num_tracefiles; i++)
+    {
+        trace = read_trace(&stats, tracedir, tracefiles[i]);
+        if (trace->num_threads < 2)
+        {
+            if (verbose > 1)
+                printf("%s is single-threaded, not replaying it with -M\n",
+                       trace->filename);
+            free_trace(trace);
+            continue;
+        }
+
+        mem_init(sparse_mode);
+        printf("\nScaling of %s (%d threads):\n", trace->filename,
+               trace->num_threads);
+        printf("%7s", "threads");
+        for (col = 0; col < num_cols; col++)
+        {
+#if COMPARE_MODE
+            const char *name =
+                col < NUM_ALLOCATORS ? allocators[col].name : "libc";
+#else
+            const char *name = col < NUM_ALLOCATORS ? "mm" : "libc";
+#endif
+            printf("%10s Kops%8s", name, "speedup");
+        }
+        printf("\n");
+
+        limit = trace->num_threads < max_threads ? trace->num_threads
+                                                 : max_threads;
+        for (k = 1;; k = (2 * k < limit) ? 2 * k : limit)
+        {
+            printf("%7d", k);
+            for (col = 0; col < num_cols; col++)
+            {
+#if COMPARE_MODE
+                if (col < NUM_ALLOCATORS)
+                    cur_allocator = &allocators[col];
+#endif
+                double secs = eval_mt_speed(trace, k, col == NUM_ALLOCATORS);
+                double tput = trace->num_ops / (secs * 1000.0);
+                if (k == 1)
+                    base[col] = tput;
+                printf("%15.0f%7.2fx", tput, tput / base[col]);
+            }
+            printf("\n");
+            if (k == limit)
+                break;
+        }
+#if COMPARE_MODE
+        cur_allocator = &allocators[0];
+#endif
+        free_trace(trace);
+        mem_deinit();
+    }
+}
+
+/*
+ * read_tsc - Read the time stamp counter, or a nanosecond clock on machines
+ *    without one
+ */
+static inline uint64_t read_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/*
+ * latency_bucket - Histogram bucket of a latency. Values below
+ *    2^(LAT_SUB_BITS+1) get a bucket each; above that, each power of two is
+ *    split into 2^LAT_SUB_BITS buckets.
+ */
+static int latency_bucket(uint64_t ticks)
+{
+    if (ticks < (2u << LAT_SUB_BITS))
+        return (int)ticks;
+    int msb = 63 - __builtin_clzll(ticks);
+    int sub = (int)(ticks >> (msb - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1);
+    return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) + sub;
+}
+
+/*
+ * latency_bucket_max - Largest latency that falls into a bucket
+ */
+static double latency_bucket_max(int bucket)
+{
+    if (bucket < (2 << LAT_SUB_BITS))
+        return bucket;
+    int shift = (bucket >> LAT_SUB_BITS) - 1;
+    int sub = bucket & ((1 << LAT_SUB_BITS) - 1);
+    return ldexp((1 << LAT_SUB_BITS) + sub + 1, shift) - 1;
+}
+
+/*
+ * latency_percentile - Smallest bucket bound covering fraction q of the
+ *    count requests in hist
+ */
+static double latency_percentile(const size_t *hist, size_t count, double q)
+{
+    size_t rank = (size_t)ceil(q * count);
+    size_t seen = 0;
+    int b;
+
+    for (b = 0; b < LAT_BUCKETS; b++)
+    {
+        seen += hist[b];
+        if (seen >= rank && seen > 0)
+            return latency_bucket_max(b);
+    }
+    return 0;
+}
+
+/*
+ * eval_mm_latency - Replay a trace once, timing every request with the
+ *    time stamp counter, and summarize the latencies of each request type
+ *    in stats->latency. The cost of reading the counter is measured and
+ *    subtracted.
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats)
+{
+    static size_t hist[LAT_TYPES][LAT_BUCKETS];
+    uint64_t max[LAT_TYPES] = {0};
+    uint64_t overhead = UINT64_MAX;
+    uint64_t start, ticks;
+    int i, t, index;
+    char *p;
+
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i < 1000; i++)
+    {
+        start = read_tsc();
+        ticks = read_tsc() - start;
+        overhead = ticks < overhead ? ticks : overhead;
+    }
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0; i < trace->num_ops; i++)
+    {
+        index = trace->ops[i].index;
+        switch (trace->ops[i].type)
+        {
+        case ALLOC: /* mm_malloc */
+            start = read_tsc();
+            p = mm_malloc(trace->ops[i].size);
+            ticks = read_tsc() - start;
+            if (p == NULL)
+                app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            setUBCheck(false);
+            start = read_tsc();
+            p = mm_realloc(trace->blocks[index], trace->ops[i].size);
+            ticks = read_tsc() - start;
+            setUBCheck(true);
+            if (p == NULL && trace->ops[i].size != 0)
+                app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free */
+            p = index < 0 ? NULL : trace->blocks[index];
+            start = read_tsc();
+            mm_free(p);
+            ticks = read_tsc() - start;
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_latency");
+        }
+
+        ticks = ticks > overhead ? ticks - overhead : 0;
+        t = trace->ops[i].type;
+        hist[t][latency_bucket(ticks)]++;
+        max[t] = ticks > max[t] ? ticks : max[t];
+    }
+
+    /* Percentile over all requests, from the sum of the histograms */
+    static size_t all[LAT_BUCKETS];
+    size_t total = 0;
+    int b;
+    for (b = 0; b < LAT_BUCKETS; b++)
+    {
+        all[b] = 0;
+        for (t = 0; t < LAT_TYPES; t++)
+            all[b] += hist[t][b];
+        total += all[b];
+    }
+    uint64_t all_max = 0;
+    for (t = 0; t < LAT_TYPES; t++)
+        all_max = max[t] > all_max ? max[t] : all_max;
+    stats->p99 = fmin(latency_percentile(all, total, 0.99), (double)all_max);
+
+    for (t = 0; t < LAT_TYPES; t++)
+    {
+        latency_t *lat = &stats->latency[t];
+        size_t count = 0;
+        int b;
+
+        for (b = 0; b < LAT_BUCKETS; b++)
+            count += hist[t][b];
+        lat->count = count;
+        lat->max = (double)max[t];
+        /* Bucket bounds can overshoot the largest latency actually seen */
+        lat->p50 = fmin(latency_percentile(hist[t], count, 0.5), lat->max);
+        lat->p99 = fmin(latency_percentile(hist[t], count, 0.99), lat->max);
+        lat->p999 = fmin(latency_percentile(hist[t], count, 0.999), lat->max);
+    }
 }
 
 /*
@@ -1538,11 +3049,17 @@ static void eval_libc_speed(void *ptr)
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    touch_t touch = {NULL, NULL, 0};
 
     reinit_trace(trace);
 
     for (i = 0; i < trace->num_ops; i++)
     {
+        oldp = trace->ops[i].index < 0 ? NULL
+                                       : trace->blocks[trace->ops[i].index];
+        if (touch_mode != TOUCH_NONE)
+            touch_request(&touch, trace, i, false, oldp);
+
         switch (trace->ops[i].type)
         {
         case ALLOC: /* malloc */
@@ -1576,7 +3093,11 @@ static void eval_libc_speed(void *ptr)
             }
             break;
         }
+
+        if (touch_mode != TOUCH_NONE)
+            touch_request(&touch, trace, i, true, oldp);
     }
+    sink = touch.sink;
 }
 
 /*************************************
@@ -1761,6 +3282,395 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
 }
 
+/*
+ * printlatency - prints the request latency percentiles measured with -L,
+ * in time stamp counter ticks, for each request type of each valid trace.
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    static const char *type_names[LAT_TYPES] = {"malloc", "free", "realloc"};
+    int i, t;
+
+    printf("Latency (ticks):\n");
+    printf("%8s%9s%8s%8s%8s%10s  %s\n", "request", "count", "p50", "p99",
+           "p99.9", "max", "trace");
+    for (i = 0; i < n; i++)
+    {
+        if (!stats[i].valid)
+            continue;
+        for (t = 0; t < LAT_TYPES; t++)
+        {
+            latency_t *lat = &stats[i].latency[t];
+            if (lat->count == 0)
+                continue;
+            printf("%8s%9zu%8.0f%8.0f%8.0f%10.0f  %s\n", type_names[t],
+                   lat->count, lat->p50, lat->p99, lat->p999, lat->max,
+                   stats[i].filename);
+        }
+    }
+}
+
+/*
+ * printcounters - prints the hardware event counts measured with -H while
+ * the throughput was measured: instructions per cycle, and misses per
+ * request. Events this machine cannot count are shown as "--".
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    int i;
+
+    printf("Hardware counters (per request):\n");
+    printf("%6s%9s%9s%9s%9s%9s  %s\n", "IPC", "instrs", "L1d", "LLC",
+           "branch", "dTLB", "trace");
+    for (i = 0; i < n; i++)
+    {
+        if (!stats[i].valid || !stats[i].has_counts)
+            continue;
+        fcyc_counts_t *c = &stats[i].counts;
+        double events[] = {c->instructions, c->l1d_misses, c->llc_misses,
+                           c->branch_misses, c->dtlb_misses};
+        size_t e;
+
+        if (c->cycles > 0 && c->instructions >= 0)
+            printf("%6.2f", c->instructions / c->cycles);
+        else
+            printf("%6s", "--");
+        for (e = 0; e < sizeof(events) / sizeof(events[0]); e++)
+        {
+            if (events[e] >= 0)
+                printf("%9.2f", events[e] / stats[i].ops);
+            else
+                printf("%9s", "--");
+        }
+        printf("  %s\n", stats[i].filename);
+    }
+}
+
+/*
+ * printtimeline - Compare each trace's utilization at the end of the trace,
+ * which is what gets scored, with its utilization averaged over all requests
+ */
+static void printtimeline(int n, stats_t *stats)
+{
+    int i;
+
+    printf("Utilization over time:\n");
+    printf("%9s%9s  %s\n", "final", "average", "trace");
+    for (i = 0; i < n; i++)
+    {
+        if (!stats[i].valid)
+            continue;
+        printf("%8.1f%%%8.1f%%  %s\n", stats[i].util * 100.0,
+               stats[i].time_util * 100.0, stats[i].filename);
+    }
+}
+
+/*
+ * trace_basename - a trace's file name without its directory, so reports
+ * from runs with different -t directories can be compared
+ */
+static const char *trace_basename(const char *filename)
+{
+    const char *slash = strrchr(filename, '/');
+    return slash != NULL ? slash + 1 : filename;
+}
+
+/*
+ * write_report - writes one row per allocator and trace to path: JSON, one
+ * object per line, if the name ends in ".json", otherwise CSV. Throughput
+ * is in ops/s; p99 is the 99th percentile latency in ticks over all
+ * requests, and is only known with -L.
+ */
+static void write_report(const char *path, int n, int num_allocs,
+                         const char **names, stats_t **stats)
+{
+    size_t len = strlen(path);
+    bool json = len >= 5 && strcmp(path + len - 5, ".json") == 0;
+    FILE *fp;
+    int a, i;
+
+    if ((fp = fopen(path, "w")) == NULL)
+        unix_error("Could not open %s in write_report", path);
+
+    if (json)
+        fprintf(fp, "[\n");
+    else
+        fprintf(fp, "allocator,trace,valid,ops,ops_per_sec,util,p99_ticks,"
+                    "sbrk_calls\n");
+    for (a = 0; a < num_allocs; a++)
+    {
+        for (i = 0; i < n; i++)
+        {
+            stats_t *st = &stats[a][i];
+            bool last = a == num_allocs - 1 && i == n - 1;
+            char p99[32] = "";
+
+            if (latency_mode && st->valid && strcmp(names[a], "libc") != 0)
+                snprintf(p99, sizeof(p99), "%.0f", st->p99);
+            if (json)
+                fprintf(fp,
+                        "{\"allocator\": \"%s\", \"trace\": \"%s\", "
+                        "\"valid\": %s, \"ops\": %.0f, \"ops_per_sec\": %.0f, "
+                        "\"util\": %.4f, \"p99_ticks\": %s, "
+                        "\"sbrk_calls\": %zu}%s\n",
+                        names[a], trace_basename(st->filename),
+                        st->valid ? "true" : "false", st->ops,
+                        st->tput * 1000.0, st->util, p99[0] ? p99 : "null",
+                        st->sbrk_calls, last ? "" : ",");
+            else
+                fprintf(fp, "%s,%s,%d,%.0f,%.0f,%.4f,%s,%zu\n", names[a],
+                        trace_basename(st->filename), st->valid, st->ops,
+                        st->tput * 1000.0, st->util, p99, st->sbrk_calls);
+        }
+    }
+    if (json)
+        fprintf(fp, "]\n");
+    fclose(fp);
+}
+
+/*
+ * read_report - reads a report written by write_report in either format.
+ * Returns the number of rows, and the rows in *rows.
+ */
+static int read_report(const char *path, report_row_t **rows)
+{
+    char line[2 * MAXLINE];
+    char valid[8], p99[32];
+    int num_rows = 0, max_rows = 0;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        unix_error("Could not open %s in read_report", path);
+
+    *rows = NULL;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        report_row_t row;
+        int fields;
+
+        valid[0] = '\0';
+        if (line[0] == '{')
+        {
+            fields = sscanf(line,
+                            "{\"allocator\": \"%31[^\"]\", \"trace\": "
+                            "\"%1023[^\"]\", \"valid\": %7[a-z], \"ops\": %lf, "
+                            "\"ops_per_sec\": %lf, \"util\": %lf, "
+                            "\"p99_ticks\": %31[^,], \"sbrk_calls\": %zu",
+                            row.allocator, row.trace, valid, &row.ops,
+                            &row.ops_per_sec, &row.util, p99, &row.sbrk_calls);
+            row.valid = strcmp(valid, "true") == 0;
+        }
+        else
+        {
+            /* CSV fields can be empty, so split with strsep */
+            char *field[8], *cur = line;
+            fields = 0;
+            line[strcspn(line, "\n")] = '\0';
+            while (fields < 8 && cur != NULL)
+                field[fields++] = strsep(&cur, ",");
+            if (fields != 8 || strcmp(field[0], "allocator") == 0)
+                continue;
+            snprintf(row.allocator, sizeof(row.allocator), "%s", field[0]);
+            snprintf(row.trace, sizeof(row.trace), "%s", field[1]);
+            row.valid = strcmp(field[2], "1") == 0;
+            row.ops = atof(field[3]);
+            row.ops_per_sec = atof(field[4]);
+            row.util = atof(field[5]);
+            snprintf(p99, sizeof(p99), "%s", field[6]);
+            row.sbrk_calls = strtoul(field[7], NULL, 10);
+        }
+        if (fields != 8)
+            continue; /* header, brackets, or a line we don't understand */
+
+        row.p99 = (p99[0] == '\0' || strcmp(p99, "null") == 0) ? -1.0
+                                                               : atof(p99);
+        if (num_rows == max_rows)
+        {
+            max_rows = max_rows ? 2 * max_rows : 64;
+            *rows = realloc(*rows, max_rows * sizeof(report_row_t));
+            if (*rows == NULL)
+                unix_error("realloc failed in read_report");
+        }
+        (*rows)[num_rows++] = row;
+    }
+    fclose(fp);
+    return num_rows;
+}
+
+/*
+ * check_baseline - compares this run with the report in path, and prints
+ * every allocator and trace that got worse by more than regress_threshold
+ * percent: lower utilization, higher p99 latency (when both runs measured
+ * it), or failing a trace it used to pass. Throughput of a single trace
+ * varies by tens of percent from run to run, so it is compared per
+ * allocator instead, as the harmonic mean over the traces that both runs
+ * passed, the same average the perf index uses. As in the perf index,
+ * throughput and latency are only compared on traces weighted for
+ * throughput and utilization on traces weighted for utilization, so
+ * weight 0 traces are not gated at all. Rows that are in only one of the
+ * two runs are ignored. Returns the number of regressions.
+ */
+static int check_baseline(const char *path, int n, int num_allocs,
+                          const char **names, stats_t **stats)
+{
+    report_row_t *rows;
+    int num_rows = read_report(path, &rows);
+    double tol = regress_threshold / 100.0;
+    int regressions = 0, compared = 0;
+    int a, i, r;
+
+    for (a = 0; a < num_allocs; a++)
+    {
+        double base_inv = 0.0, tput_inv = 0.0;
+        int perf_traces = 0;
+
+        for (i = 0; i < n; i++)
+        {
+            stats_t *st = &stats[a][i];
+            const char *trace = trace_basename(st->filename);
+            const report_row_t *base = NULL;
+
+            for (r = 0; r < num_rows && base == NULL; r++)
+                if (strcmp(rows[r].allocator, names[a]) == 0 &&
+                    strcmp(rows[r].trace, trace) == 0)
+                    base = &rows[r];
+            if (base == NULL || !base->valid || st->weight == WNONE)
+                continue;
+            compared++;
+            bool perf_counts = st->weight == WALL || st->weight == WPERF;
+            bool util_counts = st->weight == WALL || st->weight == WUTIL;
+
+            if (!st->valid)
+            {
+                printf("REGRESSION %s %s: no longer valid\n", names[a], trace);
+                regressions++;
+                continue;
+            }
+            if (perf_counts && base->ops_per_sec > 0 && st->tput > 0)
+            {
+                base_inv += 1.0 / base->ops_per_sec;
+                tput_inv += 1.0 / (st->tput * 1000.0);
+                perf_traces++;
+            }
+            if (util_counts && st->util < base->util * (1 - tol))
+            {
+                printf("REGRESSION %s %s: util %.1f%% -> %.1f%%\n", names[a],
+                       trace, 100.0 * base->util, 100.0 * st->util);
+                regressions++;
+            }
+            if (perf_counts && latency_mode && base->p99 > 0 &&
+                st->p99 > base->p99 * (1 + tol))
+            {
+                printf("REGRESSION %s %s: p99 %.0f -> %.0f ticks\n", names[a],
+                       trace, base->p99, st->p99);
+                regressions++;
+            }
+        }
+
+        if (perf_traces > 0 && !sparse_mode)
+        {
+            double base_tput = perf_traces / base_inv;
+            double tput = perf_traces / tput_inv;
+            if (tput < base_tput * (1 - tol))
+            {
+                printf("REGRESSION %s throughput over %d traces: %.0f -> %.0f "
+                       "ops/s (%+.1f%%)\n",
+                       names[a], perf_traces, base_tput, tput,
+                       100.0 * (tput / base_tput - 1));
+                regressions++;
+            }
+        }
+    }
+    printf("Baseline %s: %d regressions beyond %.1f%% in %d results\n", path,
+           regressions, regress_threshold, compared);
+    free(rows);
+    return regressions;
+}
+
+#if COMPARE_MODE
+/*
+ * printcomparison - prints the utilization and throughput of every
+ * allocator in mdriver-compare side by side, one row per trace. As in
+ * printresults, "--" marks a column the trace is not weighted for, and
+ * the average covers only the weighted traces, here only the valid ones,
+ * so one failed trace doesn't zero out an allocator's whole row.
+ */
+static void printcomparison(int n, stats_t **stats)
+{
+    int i, a;
+    double sumutil[NUM_ALLOCATORS] = {0};
+    double sumtput[NUM_ALLOCATORS] = {0};
+    int util_weight[NUM_ALLOCATORS] = {0};
+    int perf_weight[NUM_ALLOCATORS] = {0};
+
+    printf("Side-by-side comparison:\n");
+    printf("%*s%*s\n", 9 * NUM_ALLOCATORS, "util", 9 * NUM_ALLOCATORS,
+           "Kops/s");
+    for (a = 0; a < NUM_ALLOCATORS; a++)
+        printf("%9s", allocators[a].name);
+    for (a = 0; a < NUM_ALLOCATORS; a++)
+        printf("%9s", allocators[a].name);
+    printf("  trace\n");
+
+    for (i = 0; i < n; i++)
+    {
+        int weight = stats[0][i].weight;
+        bool util_counts = weight == WNONE || weight == WALL || weight == WUTIL;
+        bool perf_counts = weight == WNONE || weight == WALL || weight == WPERF;
+
+        for (a = 0; a < NUM_ALLOCATORS; a++)
+        {
+            if (!stats[a][i].valid)
+                printf("%9s", "-");
+            else if (!util_counts)
+                printf("%9s", "--");
+            else
+            {
+                printf("%8.1f%%", stats[a][i].util * 100.0);
+                if (weight == WALL || weight == WUTIL)
+                {
+                    sumutil[a] += stats[a][i].util;
+                    util_weight[a]++;
+                }
+            }
+        }
+        for (a = 0; a < NUM_ALLOCATORS; a++)
+        {
+            if (!stats[a][i].valid)
+                printf("%9s", "-");
+            else if (!perf_counts)
+                printf("%9s", "--");
+            else
+            {
+                printf("%9.0f", sparse_mode ? 0.0 : stats[a][i].tput);
+                if (weight == WALL || weight == WPERF)
+                {
+                    sumtput[a] += stats[a][i].tput;
+                    perf_weight[a]++;
+                }
+            }
+        }
+        printf("  %s\n", stats[0][i].filename);
+    }
+
+    for (a = 0; a < NUM_ALLOCATORS; a++)
+    {
+        if (util_weight[a] > 0)
+            printf("%8.1f%%", sumutil[a] * 100.0 / util_weight[a]);
+        else
+            printf("%9s", "-");
+    }
+    for (a = 0; a < NUM_ALLOCATORS; a++)
+    {
+        if (perf_weight[a] > 0 && !sparse_mode)
+            printf("%9.0f", sumtput[a] / perf_weight[a]);
+        else
+            printf("%9s", "-");
+    }
+    printf("  average of valid traces\n");
+}
+#endif
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -2018,6 +3928,8 @@ static void usage(char *prog)
     fprintf(stderr, "\t-C         Calculate Checkpoint Score.\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
+    fprintf(stderr, "\t-I <n>     Check only the blocks each operation "
+                    "touched, and the whole heap every <n> ops.\n");
     fprintf(stderr, "\t-c <file>  Run trace file <file> twice, check for "
                     "correctness only.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
@@ -2026,6 +3938,34 @@ static void usage(char *prog)
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
+    fprintf(stderr, "\t-j <n>     Check traces in <n> parallel processes; "
+                    "throughput is still measured one trace at a time.\n");
+    fprintf(stderr, "\t-H         Print hardware event counts (IPC, cache, "
+                    "branch and TLB misses) per request.\n");
+    fprintf(stderr, "\t-L         Print latency percentiles of each request "
+                    "type for each trace.\n");
+    fprintf(stderr, "\t-M <n>     Replay each thread of multithreaded "
+                    "traces on its own pthread, with 1 to <n> threads.\n");
+    fprintf(stderr, "\t-P <p>     Touch payloads while measuring "
+                    "throughput: fill, chase or both.\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
+    fprintf(stderr, "\t-B <k>     Use <k> Kops/s as the benchmark throughput "
+                    "instead of measuring it\n");
+    fprintf(stderr, "\t-U <file>  Write a CSV timeline of heap size, live "
+                    "and free bytes over each trace to <file>.\n");
+    fprintf(stderr, "\t-Y <file>  Write binary heap snapshots to <file> "
+                    "for heapmap.pl, at the end of each trace.\n");
+    fprintf(stderr, "\t-y <i,j,..> Also snapshot the heap after requests "
+                    "i, j, ...\n");
+    fprintf(stderr, "\t-R <file>  Write results to <file> as JSON (if it "
+                    "ends in .json) or CSV.\n");
+    fprintf(stderr, "\t-G <file>  Exit with status 1 if a result is worse "
+                    "than in report <file>.\n");
+    fprintf(stderr, "\t-g <pct>   Tolerate results up to <pct> percent "
+                    "worse than the baseline (default 10).\n");
+#if COMPARE_MODE
+    fprintf(stderr, "Evaluates every linked allocator on the same traces and "
+                    "prints them side by side.\n");
+#endif
 }
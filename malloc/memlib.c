@@ -24,6 +24,10 @@
  * Loading from the sparse emulation uses the above lookup and then aggregates
  *  the data into a return value.
  *
+ * The page table is a hash table with long chains, so a small direct-mapped
+ *  cache of recently used pages (a software TLB) sits in front of it.  Most
+ *  accesses hit a page touched a few accesses earlier and skip the hash.
+ *
  * If an emulated access is made to an address outside of the current
  *  bounds (mem_heap_lo, mem_heap_hi), then the address is assumed to be to
  *  a non-heap location, such as stack, global variables, etc.  For some
@@ -63,6 +67,16 @@ typedef struct MBLK
     unsigned char bytes[SPARSE_PAGE_SIZE]; /* Page contents */
 } mem_block_t;
 
+/* Software TLB entry: caches the page table lookup for one page ID */
+typedef struct
+{
+    size_t id;
+    mem_block_t *block; /* NULL if the entry is empty */
+} tlb_entry_t;
+
+/* Number of TLB entries.  Must be a power of 2 */
+#define TLB_ENTRIES 256
+
 /* private global variables */
 static bool sparse = false;         /* Use sparse memory emulation */
 static unsigned char *heap;         /* Starting address of heap */
@@ -74,6 +88,7 @@ static bool show_stats =
     false; /* Should program print allocation information? */
 static bool stats_printed =
     false; /* Has information been printed about allocation */
+static size_t sbrk_calls = 0; /* Successful mem_sbrk calls since reset */
 
 /* Sparse memory representation */
 static mem_block_t *next_free_page = NULL; /* Next free page */
@@ -81,6 +96,7 @@ static size_t num_pages = 0;               /* Total number of pages */
 static size_t num_free_pages = 0;          /* Number of free pages */
 static mem_block_t **page_table = NULL;    /* Hash table from page ID to page */
 static size_t num_buckets = 0;             /* Number of buckets in page table */
+static tlb_entry_t tlb[TLB_ENTRIES];       /* Recently used pages */
 
 #ifdef NO_CHECK_UB
 static const bool checkUB = false;
@@ -113,6 +129,9 @@ const char *__msan_default_options()
 static size_t page_id(const void *addr);
 static void *page_start(size_t id);
 static void *get_mem(const void *addr, size_t, bool);
+static bool in_sparse_heap(const void *addr, size_t len);
+static size_t page_left(const void *addr);
+static void tlb_flush(void);
 static void print_stats();
 
 /*
@@ -172,6 +191,7 @@ void mem_init(bool do_sparse)
         mem_max_addr = heap + MAX_DENSE_HEAP;
     }
     stats_printed = false;
+    sbrk_calls = 0;
     mem_brk = heap;
 }
 
@@ -186,6 +206,7 @@ void mem_deinit(void)
     num_free_pages = 0;
     page_table = NULL;
     num_buckets = 0;
+    tlb_flush();
 }
 
 /*
@@ -202,6 +223,7 @@ void mem_reset_brk()
         /* First page is just beyond page table */
         next_free_page = (mem_block_t *)((unsigned char *)page_table + ptb);
         num_free_pages = num_pages;
+        tlb_flush();
     }
     else
     {
@@ -217,6 +239,7 @@ void mem_reset_brk()
         __msan_allocated_memory(heap, MAX_DENSE_HEAP);
 #endif
     }
+    sbrk_calls = 0;
     mem_brk = heap;
 }
 
@@ -262,6 +285,7 @@ void *mem_sbrk(intptr_t incr)
         __asan_unpoison_memory_region(mem_brk, incr);
 #endif
         mem_brk += incr;
+        sbrk_calls++;
         return (void *)old_brk;
     }
     else
@@ -295,6 +319,15 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - heap);
 }
 
+/*
+ * mem_sbrk_calls() - returns the number of successful mem_sbrk calls since
+ *    the heap was last reset
+ */
+size_t mem_sbrk_calls()
+{
+    return sbrk_calls;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -415,6 +448,32 @@ void *mem_memcpy(void *dst, const void *src, size_t num_bytes)
 {
     void *savedst = dst;
     size_t word_size = sizeof(uint64_t);
+    bool overlap = (unsigned char *)dst < (unsigned char *)src + num_bytes &&
+                   (unsigned char *)src < (unsigned char *)dst + num_bytes;
+    if (!overlap && in_sparse_heap(dst, num_bytes) &&
+        in_sparse_heap(src, num_bytes))
+    {
+        /*
+         * Copy page by page, checking and marking whole ranges at once.
+         *  Overlapping copies take the word loop below, which checks each
+         *  source word after the previous destination words were written.
+         */
+        while (num_bytes > 0)
+        {
+            size_t len = num_bytes;
+            if (len > page_left(src))
+                len = page_left(src);
+            if (len > page_left(dst))
+                len = page_left(dst);
+            void *psrc = get_mem(src, len, false);
+            void *pdst = get_mem(dst, len, true);
+            memcpy(pdst, psrc, len);
+            num_bytes -= len;
+            src = (void *)((unsigned char *)src + len);
+            dst = (void *)((unsigned char *)dst + len);
+        }
+        return savedst;
+    }
     while (num_bytes >= word_size)
     {
         uint64_t data = mem_read(src, word_size);
@@ -439,6 +498,20 @@ void *mem_memset(void *dst, int c, size_t num_bytes)
     uint64_t data = 0;
     size_t word_size = sizeof(uint64_t);
     size_t i;
+    if (in_sparse_heap(dst, num_bytes))
+    {
+        /* Fill page by page, marking whole ranges at once */
+        while (num_bytes > 0)
+        {
+            size_t len = num_bytes;
+            if (len > page_left(dst))
+                len = page_left(dst);
+            memset(get_mem(dst, len, true), c, len);
+            num_bytes -= len;
+            dst = (void *)((unsigned char *)dst + len);
+        }
+        return savedst;
+    }
     for (i = 0; i < word_size; i++)
     {
         data = data | (byte << (8 * i));
@@ -523,10 +596,80 @@ static void *page_start(size_t id)
     return (void *)((unsigned char *)SPARSE_HEAP_START + offset);
 }
 
-/* Get memory to store value.  Allocate page if necessary */
-static void *get_mem(const void *addr, size_t size, bool isWrite)
+/* Is [addr, addr+len) in the emulated part of a sparse heap? */
+static bool in_sparse_heap(const void *addr, size_t len)
+{
+    return sparse && (unsigned char *)addr >= heap &&
+           (unsigned char *)addr + len <= mem_brk;
+}
+
+/* Number of bytes from addr to the end of its page */
+static size_t page_left(const void *addr)
+{
+    size_t offset = (unsigned char *)addr - (unsigned char *)SPARSE_HEAP_START;
+    return SPARSE_PAGE_SIZE - offset % SPARSE_PAGE_SIZE;
+}
+
+/*
+ * Mark len bytes of a page, starting at offset, as initialized.  One
+ *  initSet byte covers 8 bytes, so an aligned 8-byte write sets one byte,
+ *  and longer ranges set the partial bytes at their ends with a mask and
+ *  the rest with memset.
+ */
+static void init_range(mem_block_t *block, size_t offset, size_t len)
+{
+    size_t end = offset + len - 1;
+    size_t first = offset / 8, last = end / 8;
+    unsigned char head = (unsigned char)(0xFF << (offset & 0x7));
+    unsigned char tail = (unsigned char)(0xFF >> (7 - (end & 0x7)));
+
+    if (len == 0)
+        return;
+    if (first == last)
+    {
+        block->initSet[first] |= head & tail;
+        return;
+    }
+    block->initSet[first] |= head;
+    memset(&block->initSet[first + 1], 0xFF, last - first - 1);
+    block->initSet[last] |= tail;
+}
+
+/*
+ * Find the first byte of a range of len bytes at offset that was never
+ *  written.  Returns its offset, or offset + len if all of them were.
+ */
+static size_t find_uninit(const mem_block_t *block, size_t offset, size_t len)
+{
+    size_t end = offset + len - 1;
+    size_t first = offset / 8, last = end / 8;
+    size_t i;
+
+    if (len == 0)
+        return offset;
+    for (i = first; i <= last; i++)
+    {
+        unsigned mask = 0xFF;
+        if (i == first)
+            mask &= 0xFF << (offset & 0x7);
+        if (i == last)
+            mask &= 0xFF >> (7 - (end & 0x7));
+        unsigned missing = mask & ~(unsigned)block->initSet[i];
+        if (missing)
+            return i * 8 + (size_t)__builtin_ctz(missing);
+    }
+    return offset + len;
+}
+
+/* Empty the TLB.  Needed whenever the page table is cleared */
+static void tlb_flush(void)
+{
+    memset(tlb, 0, sizeof(tlb));
+}
+
+/* Find the page with a given ID in the page table.  Allocate it if necessary */
+static mem_block_t *find_page(size_t id)
 {
-    size_t id = page_id(addr);
     size_t b = id % num_buckets; // A very simple hash function
     unsigned int i;
 
@@ -555,26 +698,43 @@ static void *get_mem(const void *addr, size_t size, bool isWrite)
             block->initSet[i] = 0;
         page_table[b] = block;
     }
+    return block;
+}
+
+/* Get memory to store value.  Allocate page if necessary */
+static void *get_mem(const void *addr, size_t size, bool isWrite)
+{
+    size_t id = page_id(addr);
+
+    tlb_entry_t *entry = &tlb[id & (TLB_ENTRIES - 1)];
+    mem_block_t *block = entry->block;
+    if (!block || entry->id != id)
+    {
+        block = find_page(id);
+        entry->id = id;
+        entry->block = block;
+    }
 
     // Convert an emulated address into an offset
     void *saddr = page_start(id);
     size_t offset = (unsigned char *)addr - (unsigned char *)saddr;
 
 #ifndef NO_CHECK_UB
-    // Compute the bit vector lookup for this 'offset'
-    size_t offsetIdx = offset / 8;
-    size_t offsetBit = offset & 0x7;
-
-    // For each byte in this access, update the bitvector that tracks
-    //  the use / initialization of emulated bytes.
-    for (i = 0; i < size; i++)
+    // Update or check the bitvector that tracks the use / initialization of
+    //  the emulated bytes in this access.  Accesses that run past the end of
+    //  the page only cover the bytes of this page; the caller handles the
+    //  rest with a second call.
+    size_t len = size;
+    if (len > SPARSE_PAGE_SIZE - offset)
+        len = SPARSE_PAGE_SIZE - offset;
+    if (isWrite)
     {
-        if (isWrite)
-        {
-            block->initSet[offsetIdx] |= (0x1 << offsetBit);
-        }
-        else if (checkUB &&
-                 (block->initSet[offsetIdx] & (0x1 << offsetBit)) == 0)
+        init_range(block, offset, len);
+    }
+    else if (checkUB)
+    {
+        size_t bad = find_uninit(block, offset, len);
+        if (bad < offset + len)
         {
             // The student code has attempted to read an address that was
             //  never written to.  Students should set a breakpoint on this
@@ -583,17 +743,9 @@ static void *get_mem(const void *addr, size_t size, bool isWrite)
             fprintf(stderr,
                     "Attempt to read uninitialized address %p, see %s:%d for "
                     "details\n",
-                    (addr + i), __FILE__, __LINE__);
+                    (addr + (bad - offset)), __FILE__, __LINE__);
             abort();
         }
-        offsetBit++;
-        if (offsetBit == 8)
-        {
-            offsetBit = 0;
-            offsetIdx++;
-        }
-        if (offsetIdx == (SPARSE_PAGE_SIZE / 8))
-            break;
     }
 #endif
 
@@ -61,6 +61,12 @@ void *mem_heap_hi(void);
  */
 size_t mem_heapsize(void);
 
+/**
+ * @brief Returns the number of times the heap was extended.
+ * @return The number of successful mem_sbrk calls since the heap was reset
+ */
+size_t mem_sbrk_calls(void);
+
 /**
  * @brief Returns the system page size.
  * @return The page size of the system, in bytes
@@ -0,0 +1,677 @@
+/**
+ * @file mm-buddy.c
+ * @brief A 64-bit binary buddy allocator
+ *
+ * An alternative malloc package with the same interface as mm.c, so the two
+ * designs can be compared under the same driver (see mdriver-buddy and
+ * mdriver-compare in the Makefile).
+ *
+ * Every block is a power of two bytes long (2^order) and starts at an
+ * offset from the arena base that is a multiple of its own size. The buddy
+ * of a block is therefore found by flipping bit `order` of its offset, and
+ * splitting or merging a block costs O(1) per level with no boundary tags.
+ *
+ * Each block starts with a one-word header holding its order and allocation
+ * bit. The arena base sits one word past a 16-byte boundary so that every
+ * payload is 16-byte aligned. Free blocks are kept on one doubly linked list
+ * per order, and a per-order bitmap records which blocks are free, so
+ * deciding whether a buddy can be merged never touches the buddy itself.
+ * One word of "non-empty list" bits finds the smallest usable order with a
+ * single count-trailing-zeros.
+ *
+ * Since mem_sbrk can only grow the heap, the arena grows at its end: before
+ * a block of order k is appended, the end is padded up to a multiple of 2^k
+ * with smaller free blocks.
+ *
+ * The bitmaps are sized for the whole dense heap and live in static storage
+ * rather than in the heap, so they are not charged to utilization. They are
+ * also far over the 128-byte global limit of mdriver-emulate; this package
+ * is only meant to be run by the dense drivers.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+/* Do not change the following! */
+
+#ifdef DRIVER
+/* create aliases for driver tests */
+#define malloc mm_malloc
+#define free mm_free
+#define realloc mm_realloc
+#define calloc mm_calloc
+#define memset mem_memset
+#define memcpy mem_memcpy
+#endif /* def DRIVER */
+
+/* You can change anything from here onward */
+
+/*
+ * If DEBUG is defined (such as when running mdriver-dbg), these macros
+ * are enabled. You can use them to print debugging output and to check
+ * contracts only in debug mode.
+ *
+ * Only debugging macros with names beginning "dbg_" are allowed.
+ * You may not define any other macros having arguments.
+ */
+#ifdef DEBUG
+/* When DEBUG is defined, these form aliases to useful functions */
+#define dbg_printf(...) printf(__VA_ARGS__)
+#define dbg_requires(expr) assert(expr)
+#define dbg_assert(expr) assert(expr)
+#define dbg_ensures(expr) assert(expr)
+#else
+/* When DEBUG is not defined, no code gets generated for these */
+/* The sizeof() hack is used to avoid "unused variable" warnings */
+#define dbg_printf(...) (sizeof(__VA_ARGS__), -1)
+#define dbg_requires(expr) (sizeof(expr), 1)
+#define dbg_assert(expr) (sizeof(expr), 1)
+#define dbg_ensures(expr) (sizeof(expr), 1)
+#endif
+
+/* Basic constants */
+
+typedef uint64_t word_t;
+
+/** @brief Word and header size (bytes) */
+static const size_t wsize = sizeof(word_t);
+
+/** @brief Payload alignment (bytes) */
+static const size_t dsize = 2 * sizeof(word_t);
+
+enum {
+    /** @brief Smallest block: header plus the two free list links */
+    min_order = 5,
+
+    /** @brief Largest block; 2^27 bytes covers the 100 MB dense heap */
+    max_order = 27,
+
+    /** @brief Words needed for the free bitmaps of all orders */
+    map_words = (1 << (max_order - min_order - 5)) + max_order
+};
+
+/** @brief The mask to isolate the order in the header */
+static const word_t order_mask = 0x3F;
+
+/** @brief The mask to isolate the allocation bit in the header */
+static const word_t alloc_mask = 0x80;
+
+/** @brief Represents the header and payload of one block in the heap */
+typedef struct block {
+    /** @brief Header contains order + allocation flag */
+    word_t header;
+
+    /**
+     * @brief The payload, overlaid with the free list links while the
+     *        block is free
+     */
+    union {
+        struct {
+            struct block *next;
+            struct block *prev;
+        };
+        char payload[0];
+    };
+} block_t;
+
+/* Global variables */
+
+/** @brief Address of the block at offset 0; NULL before mm_init */
+static char *arena_base = NULL;
+
+/** @brief Bytes of the heap currently carved into blocks */
+static size_t arena_size = 0;
+
+/** @brief Head of the free list of each order */
+static block_t *free_head[max_order + 1];
+
+/** @brief Bit k is set if free_head[k] is non-empty */
+static uint64_t nonempty = 0;
+
+/** @brief First word of each order's free bitmap within free_map */
+static size_t map_start[max_order + 1];
+
+/** @brief One bit per possible block of each order, set if it is free */
+static uint64_t free_map[map_words];
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN SHORT HELPER FUNCTIONS
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief Returns the number of bytes in a block of the given order.
+ * @param[in] order
+ * @return 2^order
+ */
+static size_t order_size(unsigned order) {
+    return (size_t)1 << order;
+}
+
+/**
+ * @brief Returns the smallest order whose blocks hold `asize` bytes.
+ * @param[in] asize Block size including the header
+ * @return The order, at least min_order
+ */
+static unsigned size_to_order(size_t asize) {
+    if (asize <= order_size(min_order)) {
+        return min_order;
+    }
+    return (unsigned)(64 - __builtin_clzl(asize - 1));
+}
+
+/**
+ * @brief Packs the order and allocation status of a block into a header.
+ * @param[in] order
+ * @param[in] alloc True if the block is allocated
+ * @return The packed value
+ */
+static word_t pack(unsigned order, bool alloc) {
+    return alloc ? (order | alloc_mask) : order;
+}
+
+/**
+ * @brief Extracts the order of a block from its header.
+ * @param[in] block
+ * @return The order of the block
+ */
+static unsigned get_order(block_t *block) {
+    return (unsigned)(block->header & order_mask);
+}
+
+/**
+ * @brief Returns the allocation status of a block, based on its header.
+ * @param[in] block
+ * @return The allocation status of the block
+ */
+static bool get_alloc(block_t *block) {
+    return (block->header & alloc_mask) != 0;
+}
+
+/**
+ * @brief Given a payload pointer, returns a pointer to the corresponding
+ *        block.
+ * @param[in] bp A pointer to a block's payload
+ * @return The corresponding block
+ */
+static block_t *payload_to_header(void *bp) {
+    return (block_t *)((char *)bp - offsetof(block_t, payload));
+}
+
+/**
+ * @brief Given a block pointer, returns a pointer to the corresponding
+ *        payload.
+ * @param[in] block
+ * @return A pointer to the block's payload
+ */
+static void *header_to_payload(block_t *block) {
+    return (void *)(block->payload);
+}
+
+/**
+ * @brief Returns the offset of a block from the arena base.
+ * @param[in] block
+ * @return The offset in bytes
+ */
+static size_t block_offset(block_t *block) {
+    return (size_t)((char *)block - arena_base);
+}
+
+/**
+ * @brief Returns the block at a given offset from the arena base.
+ * @param[in] offset
+ * @return The block
+ */
+static block_t *offset_to_block(size_t offset) {
+    return (block_t *)(arena_base + offset);
+}
+
+/**
+ * @brief Tests the free bit of the block of `order` at `offset`.
+ * @param[in] order
+ * @param[in] offset Must be a multiple of 2^order
+ * @return True if that block is on the free list of `order`
+ */
+static bool map_test(unsigned order, size_t offset) {
+    size_t idx = offset >> order;
+    return (free_map[map_start[order] + idx / 64] >> (idx % 64)) & 1;
+}
+
+/**
+ * @brief Sets or clears the free bit of the block of `order` at `offset`.
+ * @param[in] order
+ * @param[in] offset Must be a multiple of 2^order
+ * @param[in] is_free The new value of the bit
+ */
+static void map_update(unsigned order, size_t offset, bool is_free) {
+    size_t idx = offset >> order;
+    uint64_t *word = &free_map[map_start[order] + idx / 64];
+    uint64_t bit = (uint64_t)1 << (idx % 64);
+    if (is_free) {
+        *word |= bit;
+    } else {
+        *word &= ~bit;
+    }
+}
+
+/**
+ * @brief Marks a block free and pushes it on the free list of its order.
+ * @param[in] block
+ * @param[in] order
+ */
+static void list_push(block_t *block, unsigned order) {
+    block->header = pack(order, false);
+    block->prev = NULL;
+    block->next = free_head[order];
+    if (free_head[order] != NULL) {
+        free_head[order]->prev = block;
+    }
+    free_head[order] = block;
+    nonempty |= (uint64_t)1 << order;
+    map_update(order, block_offset(block), true);
+}
+
+/**
+ * @brief Unlinks a block from the free list of its order.
+ * @param[in] block A free block
+ * @param[in] order
+ */
+static void list_remove(block_t *block, unsigned order) {
+    dbg_requires(!get_alloc(block) && get_order(block) == order);
+
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        free_head[order] = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+    if (free_head[order] == NULL) {
+        nonempty &= ~((uint64_t)1 << order);
+    }
+    map_update(order, block_offset(block), false);
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        END SHORT HELPER FUNCTIONS
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief Frees a block, merging it with its buddy as long as possible
+ *
+ * The buddy of the block at offset `off` is at `off ^ 2^order`. It can be
+ * merged only if it lies inside the arena and is itself a free block of the
+ * same order, which the bitmap answers without reading the buddy.
+ *
+ * @param[in] block The block to free
+ * @param[in] order Its order
+ */
+static void release_block(block_t *block, unsigned order) {
+    size_t off = block_offset(block);
+
+    while (order < max_order) {
+        size_t buddy = off ^ order_size(order);
+        if (buddy + order_size(order) > arena_size ||
+            !map_test(order, buddy)) {
+            break;
+        }
+        list_remove(offset_to_block(buddy), order);
+        off &= ~order_size(order);
+        order++;
+    }
+    list_push(offset_to_block(off), order);
+}
+
+/**
+ * @brief Takes a block of exactly `order` from the free lists
+ *
+ * Picks the smallest non-empty list of at least `order` and splits the
+ * block down, returning each upper half to the free list one order lower.
+ *
+ * @param[in] order
+ * @return An allocated block, or NULL if no free block is large enough
+ */
+static block_t *take_block(unsigned order) {
+    uint64_t usable = nonempty & (~(uint64_t)0 << order);
+    if (usable == 0) {
+        return NULL;
+    }
+
+    unsigned k = (unsigned)__builtin_ctzl(usable);
+    block_t *block = free_head[k];
+    list_remove(block, k);
+
+    while (k > order) {
+        k--;
+        list_push((block_t *)((char *)block + order_size(k)), k);
+    }
+    block->header = pack(order, true);
+    return block;
+}
+
+/**
+ * @brief Extends the arena to obtain a block of `order`
+ *
+ * The new block must start at a multiple of its size, so the end of the
+ * arena is first padded with free blocks of the largest order that keeps
+ * the end aligned. Padding may merge into a block large enough to use.
+ *
+ * @param[in] order
+ * @return An allocated block, or NULL if the heap cannot grow
+ */
+static block_t *grow_arena(unsigned order) {
+    size_t need = order_size(order);
+
+    if (arena_size + need > order_size(max_order)) {
+        return NULL;
+    }
+
+    if ((arena_size & (need - 1)) != 0) {
+        while ((arena_size & (need - 1)) != 0) {
+            unsigned pad = (unsigned)__builtin_ctzl(arena_size);
+            if (mem_sbrk((intptr_t)order_size(pad)) == (void *)-1) {
+                return NULL;
+            }
+            block_t *block = offset_to_block(arena_size);
+            arena_size += order_size(pad);
+            release_block(block, pad);
+        }
+
+        block_t *block = take_block(order);
+        if (block != NULL) {
+            return block;
+        }
+    }
+
+    if (mem_sbrk((intptr_t)need) == (void *)-1) {
+        return NULL;
+    }
+    block_t *block = offset_to_block(arena_size);
+    arena_size += need;
+    block->header = pack(order, true);
+    return block;
+}
+
+/**
+ * @brief Initializes the allocator for a new, empty heap.
+ *
+ * Only the bitmap words that covered the previous arena are cleared, so
+ * repeated initialization by the timing loop stays cheap.
+ *
+ * @return bool indicating whether initialization was successful
+ */
+bool mm_init(void) {
+    size_t start = 0;
+    for (unsigned k = min_order; k <= max_order; k++) {
+        map_start[k] = start;
+        size_t words = ((order_size(max_order) >> k) + 63) / 64;
+        size_t used = ((arena_size >> k) + 63) / 64;
+        for (size_t i = 0; i < used; i++) {
+            free_map[start + i] = 0;
+        }
+        start += words;
+    }
+    dbg_assert(start <= map_words);
+
+    for (unsigned k = 0; k <= max_order; k++) {
+        free_head[k] = NULL;
+    }
+    nonempty = 0;
+    arena_size = 0;
+
+    // Pad the heap so that payloads (one word past each block) are aligned
+    uintptr_t lo = (uintptr_t)mem_sbrk(0);
+    size_t pad = (dsize - (lo + wsize) % dsize) % dsize;
+    if (pad > 0 && mem_sbrk((intptr_t)pad) == (void *)-1) {
+        return false;
+    }
+    arena_base = (char *)(lo + pad);
+    return true;
+}
+
+/**
+ * @brief Allocates size bytes of memory
+ *
+ * @param[in] size The number of bytes to allocate
+ * @return A 16 byte aligned pointer to the newly allocated memory, or NULL
+ */
+void *malloc(size_t size) {
+    dbg_requires(mm_checkheap(__LINE__));
+
+    if (arena_base == NULL) {
+        mm_init();
+    }
+
+    if (size == 0 || size > order_size(max_order) - wsize) {
+        return NULL;
+    }
+
+    unsigned order = size_to_order(size + wsize);
+    block_t *block = take_block(order);
+    if (block == NULL) {
+        block = grow_arena(order);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+
+    dbg_ensures(mm_checkheap(__LINE__));
+    return header_to_payload(block);
+}
+
+/**
+ * @brief Frees a block returned by malloc, calloc or realloc
+ *
+ * @param[in] bp A pointer to the payload of an allocated block, or NULL
+ */
+void free(void *bp) {
+    dbg_requires(mm_checkheap(__LINE__));
+
+    if (bp == NULL) {
+        return;
+    }
+
+    block_t *block = payload_to_header(bp);
+    dbg_assert(get_alloc(block));
+    release_block(block, get_order(block));
+
+    dbg_ensures(mm_checkheap(__LINE__));
+}
+
+/**
+ * @brief Changes the size of an allocated block
+ *
+ * Shrinking splits off upper halves in place. Growing absorbs free upper
+ * buddies in place when the block is the lower half at every level up to
+ * the needed order; otherwise the data is moved to a new block.
+ *
+ * @param[in] ptr The payload to resize, or NULL to just allocate
+ * @param[in] size The new size, or 0 to just free
+ * @return A pointer to the resized payload, or NULL on failure
+ */
+void *realloc(void *ptr, size_t size) {
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+
+    if (size > order_size(max_order) - wsize) {
+        return NULL;
+    }
+
+    block_t *block = payload_to_header(ptr);
+    unsigned order = get_order(block);
+    unsigned need = size_to_order(size + wsize);
+
+    if (need <= order) {
+        while (order > need) {
+            order--;
+            release_block((block_t *)((char *)block + order_size(order)),
+                          order);
+        }
+        block->header = pack(order, true);
+        return ptr;
+    }
+
+    size_t off = block_offset(block);
+    unsigned k = order;
+    while (k < need && (off & order_size(k)) == 0 &&
+           off + 2 * order_size(k) <= arena_size &&
+           map_test(k, off + order_size(k))) {
+        k++;
+    }
+    if (k == need) {
+        for (k = order; k < need; k++) {
+            list_remove(offset_to_block(off + order_size(k)), k);
+        }
+        block->header = pack(need, true);
+        return ptr;
+    }
+
+    void *newptr = malloc(size);
+
+    // If malloc fails, the original block is left untouched
+    if (newptr == NULL) {
+        return NULL;
+    }
+
+    size_t copysize = order_size(order) - wsize;
+    if (size < copysize) {
+        copysize = size;
+    }
+    memcpy(newptr, ptr, copysize);
+    free(ptr);
+
+    return newptr;
+}
+
+/**
+ * @brief Allocates zero-initialized memory for an array
+ *
+ * @param[in] elements The number of elements in the array
+ * @param[in] size The size of each element
+ * @return A pointer to the start of the array, or NULL
+ */
+void *calloc(size_t elements, size_t size) {
+    size_t asize = elements * size;
+
+    if (elements == 0) {
+        return NULL;
+    }
+    if (asize / elements != size) {
+        // Multiplication overflowed
+        return NULL;
+    }
+
+    void *bp = malloc(asize);
+    if (bp == NULL) {
+        return NULL;
+    }
+    memset(bp, 0, asize);
+
+    return bp;
+}
+
+/**
+ * @brief Ensures the arena, free lists and bitmaps agree
+ *
+ * Walks the arena block by block, then walks every free list, checking
+ * alignment, bitmap bits, missed merges and the number of free blocks.
+ *
+ * @param[in] line the line at which the function is called
+ * @return false if the heap violates an invariant, true otherwise
+ */
+bool mm_checkheap(int line) {
+    size_t walk_free = 0;
+    size_t off = 0;
+
+    while (off < arena_size) {
+        block_t *block = offset_to_block(off);
+        unsigned order = get_order(block);
+        size_t size = order_size(order);
+
+        if (order < min_order || order > max_order) {
+            printf("Block at offset %zu has bad order %u at line %d\n", off,
+                   order, line);
+            return false;
+        }
+        if ((off & (size - 1)) != 0 || off + size > arena_size) {
+            printf("Block at offset %zu misplaced for order %u at line %d\n",
+                   off, order, line);
+            return false;
+        }
+        if (((uintptr_t)header_to_payload(block) & (dsize - 1)) != 0) {
+            printf("Block at offset %zu has unaligned payload at line %d\n",
+                   off, line);
+            return false;
+        }
+        if (map_test(order, off) == get_alloc(block)) {
+            printf("Free bitmap disagrees with block at offset %zu at line "
+                   "%d\n",
+                   off, line);
+            return false;
+        }
+        if (!get_alloc(block)) {
+            size_t buddy = off ^ size;
+            if (order < max_order && buddy + size <= arena_size &&
+                map_test(order, buddy)) {
+                printf("Free buddies at offsets %zu and %zu not merged at "
+                       "line %d\n",
+                       off, buddy, line);
+                return false;
+            }
+            walk_free++;
+        }
+        off += size;
+    }
+
+    size_t list_free = 0;
+    for (unsigned k = 0; k <= max_order; k++) {
+        bool has_blocks = free_head[k] != NULL;
+        if (has_blocks != (((nonempty >> k) & 1) != 0)) {
+            printf("Non-empty bit of order %u wrong at line %d\n", k, line);
+            return false;
+        }
+        for (block_t *block = free_head[k]; block != NULL;
+             block = block->next) {
+            if (get_alloc(block) || get_order(block) != k) {
+                printf("Block on free list %u has header %" PRIx64
+                       " at line %d\n",
+                       k, block->header, line);
+                return false;
+            }
+            if (block->next != NULL && block->next->prev != block) {
+                printf("Free list %u links inconsistent at line %d\n", k,
+                       line);
+                return false;
+            }
+            list_free++;
+        }
+    }
+
+    if (walk_free != list_free) {
+        printf("Arena has %zu free blocks but free lists have %zu at line "
+               "%d\n",
+               walk_free, list_free, line);
+        return false;
+    }
+
+    return true;
+}
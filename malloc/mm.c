@@ -16,6 +16,10 @@
  * allocation status, and whether it is a mini block. Free blocks also contain a 
  * footer which mirrors the header at the end of the block so the
  * start location of the block can be found.
+ *
+ * Built with LIFETIME_SEGREGATE, small requests whose size class is
+ * predicted to be short-lived are bump-allocated from a separate nursery
+ * block instead of the seglists.
  * 
  * 
  *
@@ -65,6 +69,8 @@
 #define dbg_assert(expr) assert(expr)
 #define dbg_ensures(expr) assert(expr)
 #define dbg_printheap(...) print_heap(__VA_ARGS__)
+#define dbg_touch(block) touch_block(block)
+#define dbg_untouch(block) untouch_block(block)
 #else
 /* When DEBUG is not defined, no code gets generated for these */
 /* The sizeof() hack is used to avoid "unused variable" warnings */
@@ -73,15 +79,50 @@
 #define dbg_assert(expr) (sizeof(expr), 1)
 #define dbg_ensures(expr) (sizeof(expr), 1)
 #define dbg_printheap(...) ((void)sizeof(__VA_ARGS__))
+#define dbg_touch(block) ((void)sizeof(block))
+#define dbg_untouch(block) ((void)sizeof(block))
 #endif
 
 /* Basic constants */
 
 typedef uint64_t word_t;
 
+/*
+ * Seglist size classes. Class 0 holds only 16 byte mini blocks and class k
+ * holds the blocks larger than seglist_limit[k - 1] up to seglist_limit[k].
+ * The default classes are powers of two. seglist-tune.pl generates tables
+ * tuned to a set of traces; build with "make SEGLIST_CLASSES=<header>" to
+ * compile one in instead.
+ */
+#ifdef SEGLIST_CLASSES
+#include SEGLIST_CLASSES
+#else
 /** @brief How many elements we want in the seglist **/
 static const size_t seglist_length = 15;
 
+/** @brief Largest block size held by each seglist class */
+static const size_t seglist_limit[] = {
+    16,   48,    112,   240,   496,    1008,   2032,    4080,
+    8176, 16368, 32752, 65520, 131056, 262128, SIZE_MAX};
+
+/** @brief Largest block size covered by seglist_lookup */
+static const size_t seglist_lookup_max = 4096;
+
+/** @brief Seglist class of each block size up to the lookup max */
+static const unsigned char seglist_lookup[] = {
+    0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 8};
+#endif
+
 /** @brief Word and header size (bytes) */
 static const size_t wsize = sizeof(word_t);
 
@@ -118,6 +159,34 @@ static const word_t mini_mask = 0x4;
  */
 static const word_t size_mask = ~(word_t)0xF;
 
+/*
+ * Lifetime segregation. When enabled (make mdriver-lifetime), malloc
+ * predicts which requests are short-lived and bump-allocates them from a
+ * nursery: an allocated block of the main heap that is reset once
+ * everything in it has been freed, so short-lived blocks never leave holes
+ * between long-lived ones.
+ */
+#ifdef LIFETIME_SEGREGATE
+static const bool lifetime_segregate = true;
+#else
+static const bool lifetime_segregate = false;
+#endif
+
+/** @brief The mask marking a block allocated inside the nursery */
+static const word_t nursery_mask = 0x8;
+
+/** @brief Size of the nursery block (bytes) */
+static const size_t nursery_size = chunksize;
+
+/** @brief Largest block size that may be placed in the nursery */
+static const size_t nursery_max_asize = 256;
+
+/** @brief How many recent main heap allocations the predictor remembers */
+static const size_t lifetime_history = 8;
+
+/** @brief Saturation limit of the per-class lifetime scores */
+static const int lifetime_score_max = 4;
+
 /** @brief Represents the header and payload of one block in the heap */
 typedef struct block {
     /** @brief Header contains size + allocation flag */
@@ -154,6 +223,83 @@ static block_t *heap_start = NULL;
 
 static block_t* free_root[seglist_length];
 
+#ifdef DEBUG
+/*
+ * Blocks touched since the last heap check, for mm_checkheap_incremental.
+ * This is only kept in debug builds, which have no global data limit.
+ */
+
+/** @brief Most touched blocks remembered before a full check is needed */
+static const size_t touched_max = 16;
+
+/** @brief The blocks touched since the last incremental check */
+static block_t *touched[touched_max];
+
+/** @brief How many blocks have been touched since the last check */
+static size_t num_touched = 0;
+
+/**
+ * @brief Records that an operation touched a block
+ * @param[in] block a block whose final state the operation has written
+ */
+static void touch_block(block_t *block){
+    if (num_touched < touched_max){
+        touched[num_touched] = block;
+    }
+    num_touched++;
+}
+
+/**
+ * @brief Forgets a touched block that was merged into another one, since
+ * it no longer starts a block
+ * @param[in] block a block that coalescing absorbed
+ */
+static void untouch_block(block_t *block){
+    if (num_touched > touched_max){
+        return;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < num_touched; i++){
+        if (touched[i] != block){
+            touched[kept++] = touched[i];
+        }
+    }
+    num_touched = kept;
+}
+
+/**
+ * @brief Whether the malloc and free contracts check only the touched
+ * blocks, set by the driver through mm_set_incremental_checks
+ */
+static bool incremental_checks = false;
+#endif
+
+/**
+ * @brief Lifetime predictor and nursery state
+ *
+ * This lives in the payload of the first heap block rather than in globals,
+ * so lifetime segregation does not count against the global data limit.
+ * A class is predicted short-lived while its score is positive. Scores go
+ * up when a block of the class is freed soon after it was allocated and go
+ * down when a block of the class is still live once the nursery fills up.
+ */
+typedef struct {
+    /** @brief The nursery, or NULL until the first short-lived request */
+    block_t *nursery;
+    /** @brief Next unused byte of the nursery */
+    char *nursery_top;
+    /** @brief Number of live blocks in the nursery */
+    size_t nursery_live;
+    /** @brief Set once the nursery fills up, until it drains */
+    bool nursery_full;
+    /** @brief Payloads of the most recent small main heap allocations */
+    void *recent[lifetime_history];
+    /** @brief Slot of recent to overwrite next */
+    size_t recent_next;
+    /** @brief Lifetime score of each seglist class */
+    int score[seglist_length];
+} lifetime_state_t;
+
 /*
  *****************************************************************************
  * The functions below are short wrapper functions to perform                *
@@ -546,6 +692,10 @@ static block_t *get_next_free(block_t *block){
 
 /**
  * @brief Finds which explicit list where a block of the given size belongs
+ *
+ * Sizes up to seglist_lookup_max are a single table lookup; only larger
+ * blocks scan the remaining class limits.
+ *
  * @param[in] size the size of a given block
  * @return The index of the seglist where the size belongs
  *
@@ -553,14 +703,14 @@ static block_t *get_next_free(block_t *block){
 size_t get_seglist_ind(size_t size){
     dbg_requires(size != 0);
 
-    size_t count = 0;
-    if (size <= 16){
-        count = 1;
-    }else{
-        for(size_t i = (size >>4) ; i !=0; i = i>>1) count++;
+    if (size <= seglist_lookup_max){
+        return seglist_lookup[(size - 1) / dsize];
     }
 
-    return min(count - 1, seglist_length -1);
+    size_t ind = seglist_lookup[(seglist_lookup_max - 1) / dsize];
+    while (size > seglist_limit[ind]) ind++;
+
+    return ind;
 
 }
 
@@ -651,6 +801,13 @@ static void remove_from_free(block_t *block){
         set_prev_free(next, prev);
     }
 
+    // The neighbors' links were rewritten
+    if (prev != NULL){
+        dbg_touch(prev);
+    }
+    if (next != NULL){
+        dbg_touch(next);
+    }
 }
 
 
@@ -679,6 +836,7 @@ static void add_to_free(block_t *block){
 
     }else{
         set_prev_free(free_root[seglist_ind],block);
+        dbg_touch(free_root[seglist_ind]);
 
         set_next_free(block, free_root[seglist_ind]);
 
@@ -689,6 +847,41 @@ static void add_to_free(block_t *block){
 
 }
 
+/**
+ * @brief Returns whether an allocated block was placed in the nursery
+ * @param[in] block An allocated block
+ * @return true if the block is inside the nursery, false otherwise
+ */
+static bool in_nursery(block_t *block) {
+    return (bool)(block->header & nursery_mask);
+}
+
+/**
+ * @brief Returns where the first block of the nursery goes, one word into
+ * its payload so that nursery payloads stay aligned
+ * @param[in] nursery The nursery block
+ * @return The header address of the first block
+ */
+static char *nursery_start(block_t *nursery) {
+    return (char *)header_to_payload(nursery) + wsize;
+}
+
+/**
+ * @brief Returns the end of the space available in the nursery
+ * @param[in] nursery The nursery block
+ * @return The address just past the nursery
+ */
+static char *nursery_end(block_t *nursery) {
+    return (char *)header_to_payload(nursery) + get_payload_size(nursery);
+}
+
+/**
+ * @brief Returns the lifetime predictor state, kept in the first heap block
+ * @return A pointer to the state
+ */
+static lifetime_state_t *lifetime_state(void) {
+    return (lifetime_state_t *)header_to_payload(heap_start);
+}
 
 
 
@@ -737,6 +930,8 @@ static block_t *coalesce_block(block_t *block) {
         remove_from_free(prev);
         remove_from_free(next);
         remove_from_free(block);
+        dbg_untouch(block);
+        dbg_untouch(next);
 
         write_block(prev,new_size,false, true);
         add_to_free(prev);
@@ -747,6 +942,7 @@ static block_t *coalesce_block(block_t *block) {
 
         remove_from_free(next);
         remove_from_free(block);
+        dbg_untouch(next);
 
         write_block(block,new_size,false, true);
         add_to_free(block);
@@ -758,6 +954,7 @@ static block_t *coalesce_block(block_t *block) {
 
         remove_from_free(prev);
         remove_from_free(block);
+        dbg_untouch(block);
 
         write_block(prev, new_size, false,true);
         add_to_free(prev);
@@ -1026,7 +1223,10 @@ bool check_header_and_footer(block_t *block){
         return false;
     }
 
-    if (!get_alloc(block) && *(header_to_footer(block)) != block->header){
+    // Mini blocks have no footer, and the footer's prev alloc bit is not
+    // kept up to date
+    if (!get_alloc(block) && !get_mini(block) &&
+        (*(header_to_footer(block)) ^ block->header) & ~alloc_prev_mask){
         printf("Block header and footer inconsistent");
         return false;
      }
@@ -1106,6 +1306,49 @@ bool check_explicit_list(size_t seglist_ind){
 }
 
 
+/**
+ * @brief Checks the nursery
+ *
+ * Walks the blocks bump-allocated so far and makes sure they tile the
+ * nursery up to the top and that the live count matches them.
+ *
+ * @return false if the invariants are broken, true otherwise
+ */
+bool check_nursery(){
+    lifetime_state_t *state = lifetime_state();
+    block_t *nursery = state->nursery;
+    if (nursery == NULL){
+        return true;
+    }
+    if (!get_alloc(nursery)){
+        printf("Nursery is marked as free \n");
+        return false;
+    }
+
+    size_t live = 0;
+    char *p = nursery_start(nursery);
+    while (p < state->nursery_top){
+        block_t *block = (block_t *) p;
+        if (!in_nursery(block) || get_size(block) == 0){
+            printf("Block at %lx is not a nursery block \n", (size_t) block);
+            return false;
+        }
+        if (get_alloc(block)) live++;
+        p += get_size(block);
+    }
+    if (p != state->nursery_top || state->nursery_top > nursery_end(nursery)){
+        printf("Nursery blocks do not end at the nursery top \n");
+        return false;
+    }
+    if (live != state->nursery_live){
+        printf("Nursery live count %lu, but %lu blocks are live \n",
+               state->nursery_live, live);
+        return false;
+    }
+    return true;
+}
+
+
 /**
  * @brief Ensures the heap meets various invariants
  *
@@ -1176,7 +1419,217 @@ bool mm_checkheap(int line) {
         return false;
     }
 
+    if (lifetime_segregate && !check_nursery()){
+        printf("problem with the nursery at line %d \n", line);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Checks the free list links of a free block
+ *
+ * The block's list neighbors must point back to it and belong to the same
+ * seglist, and if it has no predecessor it must be the head of its list.
+ *
+ * @param[in] block a free block
+ * @return false if the links are inconsistent, true otherwise
+ */
+bool check_free_links(block_t *block){
+    size_t seglist_ind = get_seglist_ind(get_size(block));
+    block_t *prev = get_prev_free(block);
+    block_t *next = get_next_free(block);
+
+    if (prev == NULL && free_root[seglist_ind] != block){
+        printf("Block has no predecessor but is not the head of its list \n");
+        return false;
+    }
+    if (prev != NULL && (get_next_free(prev) != block ||
+                         get_seglist_ind(get_size(prev)) != seglist_ind)){
+        printf("Previous pointer does not point to current \n");
+        return false;
+    }
+    if (next != NULL && (get_prev_free(next) != block ||
+                         get_seglist_ind(get_size(next)) != seglist_ind)){
+        printf("Next pointer does not point back to current \n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Checks one block touched by an operation against its neighbors
+ *
+ * Checks the block itself, that its neighbors in the heap agree with it
+ * about its allocation status and were coalesced with it, and its free
+ * list links if it is free.
+ *
+ * @param[in] block a block touched by the last operation
+ * @return false if the invariants are broken, true otherwise
+ */
+bool check_touched_block(block_t *block){
+    if (!within_heap_boundaries(block)){
+        printf("Touched block %lx is outside the heap \n", (size_t) block);
+        return false;
+    }
+    if (get_size(block) == 0){
+        return check_epilogue();
+    }
+    if (!check_address_alignment(block)){
+        printf("Improper Address Alignment of %lx \n", (size_t) block);
+        return false;
+    }
+    if (block != heap_start && !check_header_and_footer(block)){
+        return false;
+    }
+
+    block_t *next = find_next(block);
+    if (get_prev_alloc(next) != get_alloc(block)){
+        printf("Next block disagrees about allocation of %lx \n", (size_t) block);
+        return false;
+    }
+    if (!get_alloc(block) && !get_alloc(next)){
+        printf("Coalesce error. 2 free blocks in a row\n");
+        return false;
+    }
+    if (block != heap_start && !get_prev_alloc(block)){
+        block_t *prev = find_prev(block);
+        if (prev == NULL || get_alloc(prev) || find_next(prev) != block){
+            printf("Previous block of %lx is not a free block \n", (size_t) block);
+            return false;
+        }
+        if (!get_alloc(block)){
+            printf("Coalesce error. 2 free blocks in a row\n");
+            return false;
+        }
+    }
+
+    return get_alloc(block) || check_free_links(block);
+}
+
+/**
+ * @brief Checks only the blocks touched since the last incremental check
+ *
+ * Debug builds record the blocks each operation leaves behind, so this
+ * costs time proportional to the operations since the last check rather
+ * than to the size of the heap. Other builds keep no record and fall back
+ * to mm_checkheap, as does a debug build that lost track of what was
+ * touched.
+ *
+ * @param[in] line the line at which the function is called
+ * @return false if the heap violates an invariant, true otherwise
+ */
+bool mm_checkheap_incremental(int line) {
+#ifdef DEBUG
+    if (num_touched > touched_max){
+        num_touched = 0;
+        return mm_checkheap(line);
+    }
+
+    if (!check_prologue() || !check_epilogue()){
+        printf("There is a problem with the prologue or epilogue at %d\n", line);
+        print_heap();
+        return false;
+    }
+
+    for (size_t i = 0; i < num_touched; i++){
+        if (!check_touched_block(touched[i])){
+            printf("Touched block check failed at line %d \n", line);
+            print_heap();
+            num_touched = 0;
+            return false;
+        }
+    }
+    num_touched = 0;
+
+    if (lifetime_segregate && !check_nursery()){
+        printf("problem with the nursery at line %d \n", line);
+        return false;
+    }
+
     return true;
+#else
+    return mm_checkheap(line);
+#endif
+}
+
+/**
+ * @brief Chooses how the malloc and free contracts check the heap
+ *
+ * mdriver-dbg -I turns on incremental checks, so that each operation
+ * checks only the blocks it touched; otherwise every contract walks the
+ * whole heap. Builds without DEBUG have no contracts and ignore this.
+ *
+ * @param[in] incremental true to check only the touched blocks
+ */
+void mm_set_incremental_checks(bool incremental) {
+#ifdef DEBUG
+    incremental_checks = incremental;
+#else
+    (void)incremental;
+#endif
+}
+
+/**
+ * @brief The heap check done by the malloc and free contracts
+ * @param[in] line the line at which the function is called
+ * @return false if the heap violates an invariant, true otherwise
+ */
+static bool contract_checkheap(int line) {
+#ifdef DEBUG
+    if (incremental_checks) {
+        return mm_checkheap_incremental(line);
+    }
+#endif
+    return mm_checkheap(line);
+}
+
+/**
+ * @brief Reports the free bytes held in each seglist class
+ *
+ * Walks every free list, so it costs time proportional to the number of
+ * free blocks. mdriver calls it at sampled points of a trace to show where
+ * fragmentation builds up.
+ *
+ * @param[out] bytes the free bytes of each class
+ * @param[in] max_classes the length of bytes
+ * @return the number of classes filled in
+ */
+int mm_seglist_free_bytes(size_t *bytes, int max_classes) {
+    int n = 0;
+    for (size_t i = 0; i < seglist_length && n < max_classes; i++, n++) {
+        bytes[n] = 0;
+        for (block_t *block = free_root[i]; block != NULL;
+             block = get_next_free(block)) {
+            bytes[n] += get_size(block);
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Describes every block of the heap to a callback, in address order
+ *
+ * A nursery is reported as one allocated block. mdriver uses this to
+ * write heap snapshots, which are much smaller than print_heap's output.
+ *
+ * @param[in] visit called with the offset, size, allocation bit and free
+ * list class of each block
+ * @param[in] arg passed through to visit
+ */
+void mm_walk_heap(mm_visit_t visit, void *arg) {
+    if (heap_start == NULL) {
+        return;
+    }
+    char *lo = (char *)mem_heap_lo();
+    for (block_t *block = heap_start; get_size(block) > 0;
+         block = find_next(block)) {
+        size_t size = get_size(block);
+        bool alloc = get_alloc(block);
+        visit(arg, (size_t)((char *)block - lo), size, alloc,
+              alloc ? -1 : (int)get_seglist_ind(size));
+    }
 }
 
 
@@ -1208,6 +1661,208 @@ void free_root_init(){
 }
 
 
+/**
+ * @brief Allocates a block of size asize from the main heap
+ *
+ * Takes the best fit from the seglists, extending the heap if there is
+ * none, and splits off whatever is left over.
+ *
+ * @param[in] asize the adjusted block size
+ * @return the allocated block, or NULL if the heap could not be extended
+ */
+static block_t *heap_alloc(size_t asize) {
+    size_t extendsize; // Amount to extend heap if no fit is found
+    block_t *block;
+
+    // Search the free list for a fit
+    block = find_fit(asize);
+    
+
+    // If no fit is found, request more memory, and then and place the block
+    if (block == NULL) {
+        // Always request at least chunksize
+        extendsize = max(asize, chunksize);
+        block = extend_heap(extendsize);
+        // extend_heap returns an error
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+
+    // The block should be marked as free
+    dbg_assert(!get_alloc(block));
+
+
+    //remove from explicit list
+
+    remove_from_free(block);
+
+    // Mark block as allocated
+    size_t block_size = get_size(block);
+    write_block(block, block_size, true,true);
+
+    // Try to split the block if too large
+    split_block(block, asize);
+
+    update_next(block, true);
+
+    dbg_touch(block);
+    dbg_touch(find_next(block));
+
+    return block;
+}
+
+/**
+ * @brief Returns an allocated block to the main heap
+ * @param[in] block an allocated block that is not in a nursery
+ */
+static void heap_free(block_t *block) {
+    size_t size = get_size(block);
+
+    // The block should be marked as allocated
+    dbg_assert(get_alloc(block));
+
+
+    bool prev_alloc = get_prev_alloc(block);
+
+
+    // Mark the block as free
+    write_block(block, size, false, prev_alloc);
+    add_to_free(block);
+
+    // Try to coalesce the block with its neighbors
+    //print_heap();
+    block = coalesce_block(block);
+
+    update_next(block, false);
+
+    dbg_touch(block);
+}
+
+/**
+ * @brief Adjusts the lifetime score of the class of a block size
+ * @param[in] asize the block size
+ * @param[in] delta positive if the block turned out short-lived
+ */
+static void lifetime_update(size_t asize, int delta) {
+    lifetime_state_t *state = lifetime_state();
+    size_t ind = get_seglist_ind(asize);
+    int score = state->score[ind] + delta;
+
+    if (score > lifetime_score_max) score = lifetime_score_max;
+    if (score < -lifetime_score_max) score = -lifetime_score_max;
+    state->score[ind] = score;
+}
+
+/**
+ * @brief Predicts whether a block of size asize will be short-lived
+ * @param[in] asize the block size
+ * @return true if the block should go to the nursery
+ */
+static bool predict_short_lived(size_t asize) {
+    return asize <= nursery_max_asize &&
+           lifetime_state()->score[get_seglist_ind(asize)] > 0;
+}
+
+/**
+ * @brief Remembers a small main heap allocation, so that freeing it soon
+ * after marks its class as short-lived
+ * @param[in] bp the payload of the allocated block
+ */
+static void remember_alloc(void *bp) {
+    lifetime_state_t *state = lifetime_state();
+    state->recent[state->recent_next] = bp;
+    state->recent_next = (state->recent_next + 1) % lifetime_history;
+}
+
+/**
+ * @brief Forgets a main heap allocation that is being freed
+ * @param[in] bp the payload of the block being freed
+ * @return true if the block was one of the recent allocations
+ */
+static bool forget_alloc(void *bp) {
+    lifetime_state_t *state = lifetime_state();
+    for (size_t i = 0; i < lifetime_history; i++){
+        if (state->recent[i] == bp){
+            state->recent[i] = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Bump-allocates a block predicted short-lived from the nursery
+ *
+ * The first time the nursery fills up with blocks still live in it, their
+ * classes are penalized. Short-lived requests then go to the main heap
+ * until the nursery drains, so the nursery never costs more than one block
+ * of nursery_size.
+ *
+ * @param[in] asize the adjusted block size
+ * @return the allocated block, or NULL if it has to go to the main heap
+ */
+static block_t *nursery_alloc(size_t asize) {
+    lifetime_state_t *state = lifetime_state();
+    block_t *nursery = state->nursery;
+
+    if (nursery == NULL){
+        nursery = heap_alloc(nursery_size);
+        if (nursery == NULL){
+            return NULL;
+        }
+        state->nursery = nursery;
+        state->nursery_top = nursery_start(nursery);
+    }
+
+    if (state->nursery_full){
+        return NULL;
+    }
+
+    if (state->nursery_top + asize > nursery_end(nursery)){
+        char *p = nursery_start(nursery);
+        while (p < state->nursery_top){
+            block_t *block = (block_t *) p;
+            if (get_alloc(block)){
+                lifetime_update(get_size(block), -2 * lifetime_score_max);
+            }
+            p += get_size(block);
+        }
+        state->nursery_full = true;
+        return NULL;
+    }
+
+    block_t *block = (block_t *) state->nursery_top;
+    block->header = asize | nursery_mask | alloc_mask;
+    state->nursery_top += asize;
+    state->nursery_live++;
+
+    return block;
+}
+
+/**
+ * @brief Frees a block placed in the nursery
+ *
+ * The nursery is reset once its last live block is freed.
+ *
+ * @param[in] block an allocated block inside the nursery
+ */
+static void nursery_free(block_t *block) {
+    lifetime_state_t *state = lifetime_state();
+
+    // Only blocks freed before the nursery filled up count as short-lived
+    if (!state->nursery_full){
+        lifetime_update(get_size(block), 1);
+    }
+    block->header &= ~alloc_mask;
+
+    if (--state->nursery_live == 0){
+        state->nursery_top = nursery_start(state->nursery);
+        state->nursery_full = false;
+    }
+}
+
+
 /**
  * @brief
  *
@@ -1224,6 +1879,11 @@ bool mm_init(void) {
     // Create the initial empty heap
     word_t *start = (word_t *)(mem_sbrk(2 * wsize));
 
+#ifdef DEBUG
+    // Blocks touched in the previous heap are gone
+    num_touched = 0;
+#endif
+
 
     free_root_init();
 
@@ -1248,6 +1908,17 @@ bool mm_init(void) {
         return false;
     }
 
+    // The lifetime state takes the first block of the heap
+    if (lifetime_segregate) {
+        size_t asize = round_up(sizeof(lifetime_state_t) + wsize, dsize);
+        block_t *block = heap_alloc(asize);
+        if (block == NULL) {
+            return false;
+        }
+        dbg_assert(block == heap_start);
+        memset(header_to_payload(block), 0, sizeof(lifetime_state_t));
+    }
+
     return true;
 }
 
@@ -1259,6 +1930,9 @@ bool mm_init(void) {
  * Memory is not garbage collected and must be freed 
  * at some point using free().
  *
+ * With lifetime segregation, requests predicted to be short-lived are
+ * placed in the nursery instead of the main heap.
+ *
  * The number of bytes to allocate 
  * @param[in] size
  * 
@@ -1266,10 +1940,9 @@ bool mm_init(void) {
  * Returns a 16 byte aligned pointer to the newly allocated memory
  */
 void *malloc(size_t size) {
-    dbg_requires(mm_checkheap(__LINE__));
+    dbg_requires(contract_checkheap(__LINE__));
 
     size_t asize;      // Adjusted block size
-    size_t extendsize; // Amount to extend heap if no fit is found
     block_t *block;
     void *bp = NULL;
 
@@ -1280,49 +1953,34 @@ void *malloc(size_t size) {
 
     // Ignore spurious request
     if (size == 0) {
-        dbg_ensures(mm_checkheap(__LINE__));
+        dbg_ensures(contract_checkheap(__LINE__));
         return bp;
     }
 
     // Adjust block size to include overhead and to meet alignment requirements
     asize = max(round_up(size + wsize, dsize), min_block_size);
 
-    // Search the free list for a fit
-    block = find_fit(asize);
-    
-
-    // If no fit is found, request more memory, and then and place the block
-    if (block == NULL) {
-        // Always request at least chunksize
-        extendsize = max(asize, chunksize);
-        block = extend_heap(extendsize);
-        // extend_heap returns an error
-        if (block == NULL) {
+    if (lifetime_segregate && predict_short_lived(asize)) {
+        block = nursery_alloc(asize);
+        if (block != NULL) {
+            bp = header_to_payload(block);
+            dbg_ensures(contract_checkheap(__LINE__));
             return bp;
         }
     }
 
-    // The block should be marked as free
-    dbg_assert(!get_alloc(block));
-
-
-    //remove from explicit list
-
-    remove_from_free(block);
-
-    // Mark block as allocated
-    size_t block_size = get_size(block);
-    write_block(block, block_size, true,true);
-
-    // Try to split the block if too large
-    split_block(block, asize);
-
-    update_next(block, true);
+    block = heap_alloc(asize);
+    if (block == NULL) {
+        return bp;
+    }
 
     bp = header_to_payload(block);
 
+    if (lifetime_segregate && asize <= nursery_max_asize) {
+        remember_alloc(bp);
+    }
 
-    dbg_ensures(mm_checkheap(__LINE__));
+    dbg_ensures(contract_checkheap(__LINE__));
     return bp;
 }
 
@@ -1337,34 +1995,29 @@ void *malloc(size_t size) {
  * @param[in] bp
  */
 void free(void *bp) {
-    dbg_requires(mm_checkheap(__LINE__));
+    dbg_requires(contract_checkheap(__LINE__));
 
     if (bp == NULL) {
         return;
     }
 
     block_t *block = payload_to_header(bp);
-    size_t size = get_size(block);
-
-    // The block should be marked as allocated
-    dbg_assert(get_alloc(block));
-
-
-    bool prev_alloc = get_prev_alloc(block);
-
-
-    // Mark the block as free
-    write_block(block, size, false, prev_alloc);
-    add_to_free(block);
-
-    // Try to coalesce the block with its neighbors
-    //print_heap();
-    block = coalesce_block(block);
 
-    update_next(block, false);
+    if (lifetime_segregate) {
+        if (in_nursery(block)) {
+            nursery_free(block);
+            dbg_ensures(contract_checkheap(__LINE__));
+            return;
+        }
+        // Freed right after it was allocated, so its class is short-lived
+        if (forget_alloc(bp)) {
+            lifetime_update(get_size(block), 1);
+        }
+    }
 
+    heap_free(block);
 
-    dbg_ensures(mm_checkheap(__LINE__));
+    dbg_ensures(contract_checkheap(__LINE__));
 }
 
 /**
@@ -1409,7 +2062,11 @@ void *realloc(void *ptr, size_t size) {
     }
 
     // Copy the old data
-    copysize = get_payload_size(block); // gets size of old payload
+    if (lifetime_segregate && in_nursery(block)) {
+        copysize = get_size(block) - wsize;
+    } else {
+        copysize = get_payload_size(block); // gets size of old payload
+    }
     if (size < copysize) {
         copysize = size;
     }
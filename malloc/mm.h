@@ -74,3 +74,61 @@ extern bool mm_init(void);
  * @return  True if the heap is consistent, False otherwise.
  */
 extern bool mm_checkheap(int line);
+
+/**
+ * @brief  Check the blocks changed since the last incremental check.
+ *
+ * Cheaper than mm_checkheap on large heaps. Implementations that do not
+ * track changed blocks may simply check the whole heap.
+ *
+ * @param[in] line  The line number this function is being called at.
+ *
+ * @return  True if the checked blocks are consistent, False otherwise.
+ */
+extern bool mm_checkheap_incremental(int line);
+
+/**
+ * @brief  Choose whether debug builds check only the changed blocks.
+ *
+ * Optional: mdriver -I calls it so that the heap checks an allocator
+ * makes in its own contracts can be incremental too.
+ *
+ * @param[in] incremental  True to check only the changed blocks.
+ */
+extern void mm_set_incremental_checks(bool incremental);
+
+/**
+ * @brief  Report the free bytes in each size class of the allocator.
+ *
+ * Optional: mdriver uses it for the utilization timeline (-U) when the
+ * allocator defines it.
+ *
+ * @param[out] bytes  The free bytes in each class.
+ * @param[in] max_classes  The length of `bytes`.
+ *
+ * @return  The number of classes filled in.
+ */
+extern int mm_seglist_free_bytes(size_t *bytes, int max_classes);
+
+/**
+ * @brief  Called by mm_walk_heap for each block.
+ *
+ * @param[in] arg  The argument passed to mm_walk_heap.
+ * @param[in] offset  The block's offset from the start of the heap.
+ * @param[in] size  The block's size, including its header.
+ * @param[in] alloc  Whether the block is allocated.
+ * @param[in] seglist  The free list class of a free block, -1 if allocated.
+ */
+typedef void (*mm_visit_t)(void *arg, size_t offset, size_t size, bool alloc,
+                           int seglist);
+
+/**
+ * @brief  Visit every block of the heap in address order.
+ *
+ * Optional: mdriver uses it for heap snapshots (-Y) when the allocator
+ * defines it.
+ *
+ * @param[in] visit  The function to call for each block.
+ * @param[in] arg  Passed through to `visit`.
+ */
+extern void mm_walk_heap(mm_visit_t visit, void *arg);
@@ -0,0 +1,341 @@
+/**
+ * @file mtrace.c
+ * @brief An interpositioning library that records the allocation calls of a
+ * running program.
+ *
+ * Build it with "make mtrace.so" and run a program under it:
+ *
+ *     unix> MTRACE_OUT=prog LD_PRELOAD=./mtrace.so ./prog
+ *     unix> ./mtrace2rep.pl prog.*.log
+ *
+ * Every call to malloc, calloc, realloc and free is appended to a buffer
+ * private to the calling thread, so recording takes no locks. A full buffer
+ * is written to the log with a single write() to a file opened with
+ * O_APPEND, so buffers of different threads never interleave. Each record
+ * carries a global sequence number, which mtrace2rep.pl uses to put the
+ * records of all threads back in program order.
+ *
+ * A call is numbered after it returns, except for free, which is numbered
+ * before it releases the block. That way a block is always freed before
+ * its address is handed out again. A realloc racing with a malloc in
+ * another thread can still be logged out of order; the converter reports
+ * such records rather than guessing.
+ *
+ * Each process writes its own log, $MTRACE_OUT.<pid>.log, or
+ * mtrace.<pid>.log if MTRACE_OUT is not set, so the children a program
+ * forks or execs (which inherit LD_PRELOAD) don't overwrite its log. A
+ * forked child starts over with empty buffers and sequence numbers from 0.
+ * The records are laid out as mtrace_rec_t, in the byte order of the
+ * traced machine.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** @brief Record types */
+enum { MT_MALLOC = 0, MT_FREE = 1, MT_REALLOC = 2, MT_CALLOC = 3 };
+
+/** @brief One logged call (40 bytes) */
+typedef struct {
+    uint64_t seq;  /* global order of the call */
+    uint32_t type; /* MT_MALLOC, MT_FREE, MT_REALLOC or MT_CALLOC */
+    uint32_t tid;  /* calling thread */
+    uint64_t in;   /* pointer passed in (free, realloc) */
+    uint64_t size; /* bytes requested (nmemb * size for calloc) */
+    uint64_t out;  /* pointer returned (malloc, calloc, realloc) */
+} mtrace_rec_t;
+
+_Static_assert(sizeof(mtrace_rec_t) == 40, "mtrace_rec_t must be packed");
+
+/** @brief Records per thread buffer (64 KiB buffers) */
+#define BUF_RECS 1638
+
+/** @brief A thread's buffer of records not yet written */
+typedef struct mtrace_buf {
+    struct mtrace_buf *next; /* all buffers, for the flush at exit */
+    uint32_t tid;
+    size_t count;
+    mtrace_rec_t recs[BUF_RECS];
+} mtrace_buf_t;
+
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+
+static uint64_t next_seq = 0;
+static int log_fd = -1;
+static bool initializing = false;
+static pthread_key_t buf_key;
+static pthread_mutex_t bufs_lock = PTHREAD_MUTEX_INITIALIZER;
+static mtrace_buf_t *all_bufs = NULL;
+
+static __thread mtrace_buf_t *my_buf = NULL;
+static __thread bool in_hook = false; /* don't log our own allocations */
+
+/*
+ * dlsym may allocate before the real allocator is known; those requests are
+ * served from this arena, and never freed. Each block is preceded by a
+ * 16-byte header holding its size, for realloc.
+ */
+static char boot_arena[4096] __attribute__((aligned(16)));
+static size_t boot_used = 0;
+
+static void *boot_alloc(size_t bytes) {
+    size_t total = 16 + ((bytes + 15) & ~(size_t)15);
+    if (total > sizeof(boot_arena) - boot_used) {
+        return NULL;
+    }
+    char *p = boot_arena + boot_used + 16;
+    *(size_t *)(p - 16) = bytes;
+    boot_used += total;
+    return p; /* static storage is already zero */
+}
+
+static size_t boot_size(void *p) {
+    return *(size_t *)((char *)p - 16);
+}
+
+static bool in_boot_arena(void *p) {
+    return (char *)p >= boot_arena &&
+           (char *)p < boot_arena + sizeof(boot_arena);
+}
+
+/**
+ * @brief Write out the records of a buffer and empty it
+ */
+static void flush_buf(mtrace_buf_t *buf) {
+    if (buf->count > 0 && log_fd >= 0) {
+        size_t len = buf->count * sizeof(mtrace_rec_t);
+        if (write(log_fd, buf->recs, len) != (ssize_t)len) {
+            static const char msg[] = "mtrace: short write to log\n";
+            (void)!write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        }
+    }
+    buf->count = 0;
+}
+
+/**
+ * @brief Flush a thread's buffer when the thread exits. The buffer stays
+ * on all_bufs; it is empty now, so the flush at exit skips it.
+ */
+static void thread_exit(void *arg) {
+    flush_buf(arg);
+}
+
+/**
+ * @brief Flush every thread's buffer when the process exits
+ */
+__attribute__((destructor)) static void process_exit(void) {
+    pthread_mutex_lock(&bufs_lock);
+    for (mtrace_buf_t *buf = all_bufs; buf != NULL; buf = buf->next) {
+        flush_buf(buf);
+    }
+    pthread_mutex_unlock(&bufs_lock);
+}
+
+/**
+ * @brief Open this process's log, named after its pid
+ */
+static void open_log(void) {
+    char path[4096];
+    const char *prefix = getenv("MTRACE_OUT");
+    snprintf(path, sizeof(path), "%s.%d.log",
+             prefix != NULL ? prefix : "mtrace", (int)getpid());
+    log_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                  0644);
+}
+
+/**
+ * @brief Keep another thread from holding bufs_lock across a fork
+ */
+static void before_fork(void) {
+    pthread_mutex_lock(&bufs_lock);
+}
+
+static void after_fork_parent(void) {
+    pthread_mutex_unlock(&bufs_lock);
+}
+
+/**
+ * @brief Start the child's log afresh. The buffers it inherited hold the
+ * parent's records, which the parent writes to its own log; only the
+ * forking thread lives on in the child, under a new tid.
+ */
+static void after_fork_child(void) {
+    for (mtrace_buf_t *buf = all_bufs; buf != NULL; buf = buf->next) {
+        buf->count = 0;
+    }
+    if (my_buf != NULL) {
+        my_buf->tid = (uint32_t)syscall(SYS_gettid);
+    }
+    next_seq = 0;
+    if (log_fd >= 0) {
+        close(log_fd);
+    }
+    open_log();
+    pthread_mutex_unlock(&bufs_lock);
+}
+
+/**
+ * @brief Look up the real allocator and open the log. This runs on the
+ * first allocation, which happens before the program can start threads.
+ */
+static void init(void) {
+    initializing = true;
+    in_hook = true;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+
+    open_log();
+    pthread_key_create(&buf_key, thread_exit);
+    pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+    in_hook = false;
+    initializing = false;
+}
+
+/**
+ * @brief Get the calling thread's buffer, creating it on first use.
+ * Buffers are mapped directly, so making one doesn't recurse into malloc.
+ */
+static mtrace_buf_t *get_buf(void) {
+    if (my_buf == NULL) {
+        mtrace_buf_t *buf = mmap(NULL, sizeof(mtrace_buf_t),
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED) {
+            return NULL;
+        }
+        buf->tid = (uint32_t)syscall(SYS_gettid);
+        buf->count = 0;
+        pthread_mutex_lock(&bufs_lock);
+        buf->next = all_bufs;
+        all_bufs = buf;
+        pthread_mutex_unlock(&bufs_lock);
+        pthread_setspecific(buf_key, buf);
+        my_buf = buf;
+    }
+    return my_buf;
+}
+
+/**
+ * @brief Take the next sequence number
+ */
+static uint64_t take_seq(void) {
+    return __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Append a record to the calling thread's buffer
+ */
+static void log_call(uint64_t seq, uint32_t type, void *in, size_t size,
+                     void *out) {
+    mtrace_buf_t *buf = get_buf();
+    if (buf == NULL) {
+        return;
+    }
+    mtrace_rec_t *rec = &buf->recs[buf->count++];
+    rec->seq = seq;
+    rec->type = type;
+    rec->tid = buf->tid;
+    rec->in = (uintptr_t)in;
+    rec->size = size;
+    rec->out = (uintptr_t)out;
+    if (buf->count == BUF_RECS) {
+        flush_buf(buf);
+    }
+}
+
+void *malloc(size_t size) {
+    if (real_malloc == NULL) {
+        if (initializing) {
+            return boot_alloc(size);
+        }
+        init();
+    }
+    if (in_hook) {
+        return real_malloc(size);
+    }
+    in_hook = true;
+    void *p = real_malloc(size);
+    log_call(take_seq(), MT_MALLOC, NULL, size, p);
+    in_hook = false;
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    /* Neither the boot arena nor the log may see a wrapped product */
+    if (nmemb != 0 && size > SIZE_MAX / nmemb) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (real_calloc == NULL) {
+        if (initializing) {
+            return boot_alloc(nmemb * size);
+        }
+        init();
+    }
+    if (in_hook) {
+        return real_calloc(nmemb, size);
+    }
+    in_hook = true;
+    void *p = real_calloc(nmemb, size);
+    log_call(take_seq(), MT_CALLOC, NULL, nmemb * size, p);
+    in_hook = false;
+    return p;
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (real_realloc == NULL) {
+        if (initializing) {
+            return NULL;
+        }
+        init();
+    }
+    if (in_boot_arena(ptr)) {
+        /*
+         * Move the block out of the arena. It was never logged, so the
+         * new block is logged as a malloc.
+         */
+        void *p = malloc(size);
+        if (p != NULL) {
+            size_t old_size = boot_size(ptr);
+            memcpy(p, ptr, old_size < size ? old_size : size);
+        }
+        return p;
+    }
+    if (in_hook) {
+        return real_realloc(ptr, size);
+    }
+    in_hook = true;
+    void *p = real_realloc(ptr, size);
+    log_call(take_seq(), MT_REALLOC, ptr, size, p);
+    in_hook = false;
+    return p;
+}
+
+void free(void *ptr) {
+    if (ptr == NULL || in_boot_arena(ptr)) {
+        return;
+    }
+    if (in_hook) {
+        real_free(ptr);
+        return;
+    }
+    in_hook = true;
+    log_call(take_seq(), MT_FREE, ptr, 0, NULL);
+    real_free(ptr);
+    in_hook = false;
+}
@@ -0,0 +1,202 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+#
+# mtrace2rep.pl - Convert mtrace.so allocation logs to .rep traces
+#
+# mtrace.so writes one log per process, named PREFIX.<pid>.log, and each
+# log is converted to its own trace, PREFIX.<pid>.rep by default. The
+# processes had separate heaps, so their calls are never merged.
+#
+# mtrace.so logs one 40-byte record per call, in the byte order of the
+# traced machine:
+#
+#     uint64 seq      global order of the call
+#     uint32 type     0 malloc, 1 free, 2 realloc, 3 calloc
+#     uint32 tid      calling thread
+#     uint64 in       pointer passed in (free, realloc)
+#     uint64 size     bytes requested (nmemb * size for calloc)
+#     uint64 out      pointer returned (malloc, calloc, realloc)
+#
+# Records are sorted by seq, and every block gets a fresh id when it is
+# allocated. calloc becomes an allocate request, realloc(NULL, n) an
+# allocate and realloc(p, 0) a free. Calls mdriver can't replay are
+# dropped and counted:
+#
+#     - failed and zero-byte allocations
+#     - frees and reallocs of blocks the log never saw allocated (made
+#       before mtrace.so was loaded, by the parent before the process
+#       forked, or with memalign and friends)
+#     - allocations returning an address that is still live, which only
+#       happens when a realloc in one thread raced with another thread
+#
+# The header's max_alloc is the peak number of live payload bytes.
+#
+# With -t, each request is prefixed with its thread (t0, t1, ... in the
+# order the threads first appear), so mdriver -M can replay the threads
+# concurrently. Blocks freed by another thread than the one that allocated
+# them keep their cross-thread frees.
+#
+
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-hvft] [-w WEIGHT] [-o OUTFILE] LOG...\n";
+    printf STDERR "Options:\n";
+    printf STDERR "   -h              Print this message\n";
+    printf STDERR "   -v              Verbose mode\n";
+    printf STDERR "   -f              Free the blocks still live at the end\n";
+    printf STDERR "   -t              Tag each request with its thread\n";
+    printf STDERR "   -w WEIGHT       Trace weight (default 1)\n";
+    printf STDERR "   -o OUTFILE      Output trace, for a single LOG (default: LOG with .rep suffix)\n";
+    die "\n";
+}
+
+getopts('hvftw:o:');
+
+if ($opt_h) {
+    &usage($ARGV[0]);
+}
+
+$verbose = 0;
+if ($opt_v) {
+    $verbose = 1;
+}
+
+$weight = 1;
+if (defined($opt_w)) {
+    $weight = $opt_w;
+}
+
+if (@ARGV == 0) {
+    &usage("No logs given");
+}
+if ($opt_o && @ARGV != 1) {
+    &usage("-o takes a single log");
+}
+
+$RECSIZE = 40;
+
+foreach $infile (@ARGV) {
+    $outfile = $opt_o;
+    if (!$outfile) {
+        ($outfile = $infile) =~ s/(\.log)?$/.rep/;
+    }
+    &convert($infile, $outfile);
+}
+
+#
+# convert - Convert the log of one process to a trace
+#
+sub convert
+{
+    my ($infile, $outfile) = @_;
+    my ($log, $nrecs, @seq, @order, $r, $s, $type, $tid, $in, $size, $out);
+    my ($tag, $id, $op, $why);
+
+    open(IN, "<", $infile) || die "Couldn't open log '$infile'\n";
+    binmode(IN);
+    local $/;
+    $log = <IN>;
+    close(IN);
+
+    if (length($log) % $RECSIZE != 0) {
+        printf STDERR "$infile: ignoring %d trailing bytes\n",
+            length($log) % $RECSIZE;
+    }
+    $nrecs = int(length($log) / $RECSIZE);
+
+    # Sort record offsets by sequence number
+    @seq = unpack("(Q x32)$nrecs", $log);
+    @order = sort { $seq[$a] <=> $seq[$b] } (0 .. $nrecs - 1);
+
+    %live = ();         # address -> id of live block
+    @size = ();         # id -> current size
+    @ops = ();
+    %tids = ();         # tid -> thread number, in order of appearance
+    %last_tag = ();     # id -> tag of the thread that last touched it
+    $num_ids = 0;
+    $cur_bytes = 0;
+    $max_bytes = 0;
+    %dropped = ();
+
+    foreach $r (@order) {
+        ($s, $type, $tid, $in, $size, $out) =
+            unpack("Q L L Q Q Q", substr($log, $r * $RECSIZE, $RECSIZE));
+        if (!exists($tids{$tid})) {
+            $tids{$tid} = scalar(keys(%tids));
+        }
+        $tag = $opt_t ? "t$tids{$tid} " : "";
+
+        if ($type == 2 && $in == 0) {
+            $type = 0;                      # realloc(NULL, n) is malloc(n)
+        } elsif ($type == 2 && $size == 0) {
+            $type = 1;                      # realloc(p, 0) is free(p)
+        }
+
+        if ($type == 0 || $type == 3) {
+            if ($out == 0 || $size == 0) {
+                $dropped{"failed or empty allocations"}++;
+                next;
+            }
+            if (exists($live{$out})) {
+                $dropped{"allocations of live addresses"}++;
+                next;
+            }
+            $id = $num_ids++;
+            $live{$out} = $id;
+            $size[$id] = $size;
+            $cur_bytes += $size;
+            $last_tag{$id} = $tag;
+            push(@ops, "${tag}a $id $size");
+        } elsif ($type == 1) {
+            if (!exists($live{$in})) {
+                $dropped{"frees of unknown blocks"}++;
+                next;
+            }
+            $id = delete($live{$in});
+            $cur_bytes -= $size[$id];
+            push(@ops, "${tag}f $id");
+        } elsif ($type == 2) {
+            if (!exists($live{$in})) {
+                $dropped{"reallocs of unknown blocks"}++;
+                next;
+            }
+            if ($out == 0) {
+                $dropped{"failed reallocs"}++;
+                next;
+            }
+            $id = delete($live{$in});
+            $live{$out} = $id;
+            $cur_bytes += $size - $size[$id];
+            $size[$id] = $size;
+            $last_tag{$id} = $tag;
+            push(@ops, "${tag}r $id $size");
+        } else {
+            die "$infile: bogus record type $type at sequence number $s\n";
+        }
+        $max_bytes = $cur_bytes if ($cur_bytes > $max_bytes);
+    }
+
+    if ($opt_f) {
+        foreach $id (sort { $a <=> $b } values(%live)) {
+            push(@ops, "$last_tag{$id}f $id");
+        }
+    }
+
+    open(OUT, ">", $outfile) || die "Couldn't write '$outfile'\n";
+    printf OUT "%d\n%d\n%d\n%d\n", $weight, $num_ids, scalar(@ops), $max_bytes;
+    foreach $op (@ops) {
+        print OUT "$op\n";
+    }
+    close(OUT);
+
+    if ($verbose) {
+        printf "%s: %d calls from %d threads -> %d requests, %d ids, " .
+            "max_alloc %d\n", $outfile, $nrecs, scalar(keys(%tids)),
+            scalar(@ops), $num_ids, $max_bytes;
+    }
+    foreach $why (sort(keys(%dropped))) {
+        printf STDERR "%s: dropped %d %s\n", $infile, $dropped{$why}, $why;
+    }
+}
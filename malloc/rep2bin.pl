@@ -0,0 +1,111 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+#
+# rep2bin.pl - Convert .rep traces to the binary trace format
+#
+# A binary trace is a 32-byte header followed by one 16-byte record per
+# request, laid out exactly like mdriver's traceop_t so that mdriver can
+# mmap the records instead of parsing them:
+#
+#     header:  char magic[8] = "MLRPBIN1"
+#              int32 weight, int32 num_ids, int32 num_ops, int32 unused
+#              uint64 data_bytes
+#     request: uint32 type (0 alloc, 1 free, 2 realloc)
+#              int32 index
+#              uint64 size (0 for free)
+#
+# Fields are in the byte order of the machine running the conversion.
+# Converted traces keep their names, so mdriver can run them with
+# "-t OUTDIR"; it tells the two formats apart by the magic number.
+#
+
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-hv] [-o OUTDIR] TRACE...\n";
+    printf STDERR "Options:\n";
+    printf STDERR "   -h              Print this message\n";
+    printf STDERR "   -v              Verbose mode\n";
+    printf STDERR "   -o OUTDIR       Directory for converted traces (default traces-bin)\n";
+    die "\n";
+}
+
+getopts('hvo:');
+
+if ($opt_h) {
+    &usage($ARGV[0]);
+}
+
+$verbose = 0;
+if ($opt_v) {
+    $verbose = 1;
+}
+
+$outdir = "traces-bin";
+if ($opt_o) {
+    $outdir = $opt_o;
+}
+
+if (!@ARGV) {
+    &usage("No traces given");
+}
+
+$magic = "MLRPBIN1";
+%optype = ("a" => 0, "f" => 1, "r" => 2);
+
+if (! -d $outdir) {
+    mkdir($outdir) || die "Couldn't create directory '$outdir'\n";
+}
+
+foreach $infile (@ARGV) {
+    open(IN, "<", $infile) || die "Couldn't open trace '$infile'\n";
+    local $/;
+    @tok = split(' ', <IN>);
+    close(IN);
+
+    ($weight, $num_ids, $num_ops, $data_bytes) = splice(@tok, 0, 4);
+    if (!defined($data_bytes)) {
+        die "$infile: truncated header\n";
+    }
+
+    $out = pack("a8 l l l l Q", $magic, $weight, $num_ids, $num_ops, 0,
+                $data_bytes);
+    $ops = 0;
+    $max_index = -1;
+    while (@tok && $ops < $num_ops) {
+        $type = shift(@tok);
+        if ($type =~ /^t\d+$/) {
+            die "$infile: binary traces can't hold thread ids\n";
+        }
+        if (!exists($optype{$type})) {
+            die "$infile: bogus request type '$type' in request $ops\n";
+        }
+        $index = shift(@tok);
+        $size = ($type eq "f") ? 0 : shift(@tok);
+        if (!defined($index) || !defined($size)) {
+            die "$infile: truncated request $ops\n";
+        }
+        $out .= pack("L l Q", $optype{$type}, $index, $size);
+        $max_index = $index if ($index > $max_index);
+        $ops++;
+    }
+    if ($ops != $num_ops) {
+        die "$infile: header says $num_ops requests, found $ops\n";
+    }
+    if ($max_index != $num_ids - 1) {
+        die "$infile: header says $num_ids ids, found " . ($max_index + 1) . "\n";
+    }
+
+    ($name = $infile) =~ s|.*/||;
+    $outfile = "$outdir/$name";
+    open(OUT, ">", $outfile) || die "Couldn't write '$outfile'\n";
+    binmode(OUT);
+    print OUT $out;
+    close(OUT);
+
+    if ($verbose) {
+        printf "%s: %d requests, %d -> %d bytes\n", $name, $num_ops,
+            -s $infile, length($out);
+    }
+}
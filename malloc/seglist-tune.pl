@@ -0,0 +1,446 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+#
+# seglist-tune.pl - Tune the seglist size classes of mm.c to a set of traces
+#
+# Reads .rep traces and builds a histogram of the block sizes mm.c will
+# request (payload + header, rounded to 16 bytes) and of how long blocks
+# of each size stay live.  It then searches for class boundaries that
+# maximize
+#
+#     W * utilization + (1 - W) * throughput / baseline throughput
+#
+# where the baseline is mm.c's power-of-two classes.  Each candidate is
+# written to objs/seglist-tune.h, compiled into mdriver-tune and replayed
+# on the traces several times; its throughput is the median of the runs.
+# Unless every run of a candidate is faster (or every run slower) than
+# every run of the baseline, its throughput counts as equal to the
+# baseline's, so noise alone can't outweigh a loss in utilization.  The
+# best table is written as a header that mm.c compiles in place of its
+# default tables when built with SEGLIST_CLASSES=<header>.
+#
+
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-hvH] [-n CLASSES] [-w WEIGHT] [-e EVALS] [-r RUNS] [-o OUTFILE] [-c CC] TRACE...\n";
+    printf STDERR "Options:\n";
+    printf STDERR "   -h              Print this message\n";
+    printf STDERR "   -v              Verbose mode\n";
+    printf STDERR "   -H              Print the histogram only, do not search\n";
+    printf STDERR "   -n CLASSES      Number of seglist classes (default 15)\n";
+    printf STDERR "   -w WEIGHT       Weight of utilization in the objective (default 0.6)\n";
+    printf STDERR "   -e EVALS        Maximum number of candidate tables to replay (default 30)\n";
+    printf STDERR "   -r RUNS         Times each table is replayed (default 5)\n";
+    printf STDERR "   -o OUTFILE      Header to generate (default seglist-classes.h)\n";
+    printf STDERR "   -c CC           Compiler passed to make\n";
+    printf STDERR "Traces must have nonzero weight to count toward the objective.\n";
+    die "\n";
+}
+
+$| = 1;       # Autoflush output on every print statement
+
+getopts('hvHn:w:e:r:o:c:');
+
+if ($opt_h || @ARGV == 0) {
+    &usage($ARGV[0]);
+}
+
+$verbose = 0;
+if ($opt_v) {
+    $verbose = 1;
+}
+
+# Parameters
+$nclasses = 15;
+if ($opt_n) {
+    $nclasses = $opt_n;
+}
+if ($nclasses < 3 || $nclasses > 64) {
+    die "Number of classes must be between 3 and 64\n";
+}
+
+$util_weight = 0.6;
+if (defined($opt_w)) {
+    $util_weight = $opt_w;
+}
+
+$max_evals = 30;
+if ($opt_e) {
+    $max_evals = $opt_e;
+}
+
+$runs = 5;
+if ($opt_r) {
+    $runs = $opt_r;
+}
+
+$outfile = "seglist-classes.h";
+if ($opt_o) {
+    $outfile = $opt_o;
+}
+
+$make = "make -s";
+if ($opt_c) {
+    $make = "$make CC='$opt_c'";
+}
+
+# Must match mm.c
+$dsize = 16;
+$wsize = 8;
+$lookup_max = 4096;
+
+# Candidate header and driver (see the Makefile)
+$tune_header = "objs/seglist-tune.h";
+$tune_driver = "./mdriver-tune";
+
+@traces = @ARGV;
+
+# Adjusted block size, as computed by mm.c's malloc
+sub asize {
+    my ($size) = @_;
+    my $a = $dsize * int(($size + $wsize + $dsize - 1) / $dsize);
+    return $a < $dsize ? $dsize : $a;
+}
+
+#
+# Build the histogram.  For each adjusted size, count allocations and sum
+# the lifetimes (in operations) of the blocks of that size.  A realloc ends
+# the old block's lifetime and starts a new one.
+#
+%count = ();
+%lifetime = ();
+$total_allocs = 0;
+
+for my $t (@traces) {
+    open(my $fh, "<", $t) || die "Couldn't open trace '$t'\n";
+    my @hdr = ();
+    while (@hdr < 4 && defined(my $line = <$fh>)) {
+        push(@hdr, $line + 0);
+    }
+    my %born = ();
+    my %bsize = ();
+    my $op = 0;
+    while (my $line = <$fh>) {
+        my ($type, $id, $size) = split " ", $line;
+        next unless defined($type);
+        if ($type eq "a" || $type eq "r") {
+            if (defined($born{$id})) {
+                $lifetime{$bsize{$id}} += $op - $born{$id};
+            }
+            my $a = asize($size);
+            $count{$a}++;
+            $total_allocs++;
+            $born{$id} = $op;
+            $bsize{$id} = $a;
+        } elsif ($type eq "f") {
+            if (defined($born{$id})) {
+                $lifetime{$bsize{$id}} += $op - $born{$id};
+                delete $born{$id};
+            }
+        }
+        $op++;
+    }
+    for my $id (keys %born) {
+        $lifetime{$bsize{$id}} += $op - $born{$id};
+    }
+    close($fh);
+}
+
+if ($total_allocs == 0) {
+    die "No allocations found in traces\n";
+}
+
+@sizes = sort { $a <=> $b } keys %count;
+
+sub print_histogram {
+    my $top = 20;
+    printf "%d allocations of %d distinct block sizes\n",
+        $total_allocs, scalar(@sizes);
+    print "Most frequent block sizes:\n";
+    printf "  %10s %10s %7s %12s\n", "size", "count", "share", "avg life";
+    my @byc = sort { $count{$b} <=> $count{$a} || $a <=> $b } @sizes;
+    for my $s (@byc[0 .. ($top < @byc ? $top : @byc) - 1]) {
+        printf "  %10d %10d %6.2f%% %12.0f\n", $s, $count{$s},
+            100.0 * $count{$s} / $total_allocs, $lifetime{$s} / $count{$s};
+    }
+    print "Largest live volume (size * lifetime):\n";
+    printf "  %10s %16s\n", "size", "byte-ops";
+    my @byv = sort { $b * $lifetime{$b} <=> $a * $lifetime{$a} || $a <=> $b }
+        @sizes;
+    for my $s (@byv[0 .. ($top < @byv ? $top : @byv) - 1]) {
+        printf "  %10d %16.0f\n", $s, $s * $lifetime{$s};
+    }
+}
+
+print_histogram();
+if ($opt_H) {
+    exit(0);
+}
+
+#
+# A table is given by its inner limits: the largest block size held by
+# classes 1 .. nclasses-2.  Class 0 holds only 16-byte mini blocks and the
+# last class is unbounded.  Candidate limits are the power-of-two limits
+# plus every block size that accounts for at least 0.1% of allocations.
+#
+$ninner = $nclasses - 2;
+
+sub pow2_limits {
+    my @l = ();
+    for (my $k = 1; $k <= $ninner; $k++) {
+        push(@l, $dsize * (2 ** ($k + 1)) - $dsize);
+    }
+    return @l;
+}
+
+%point_set = ();
+for my $l (pow2_limits()) {
+    $point_set{$l} = 1;
+}
+for my $s (@sizes) {
+    if ($s > $dsize && $count{$s} >= 0.001 * $total_allocs) {
+        $point_set{$s} = 1;
+        $point_set{$s - $dsize} = 1 if $s - $dsize > $dsize;
+    }
+}
+@points = sort { $a <=> $b } keys %point_set;
+
+# Fill or trim a set of limits to exactly ninner, keeping it sorted
+sub normalize {
+    my (%keep) = @_;
+    my @l = sort { $a <=> $b } grep { $_ > $dsize } keys %keep;
+    for my $p (pow2_limits()) {
+        last if @l >= $ninner;
+        push(@l, $p) unless grep { $_ == $p } @l;
+        @l = sort { $a <=> $b } @l;
+    }
+    while (@l > $ninner) {
+        # Merge the adjacent pair of classes with the fewest allocations
+        my $best = 0;
+        my $best_count = -1;
+        for (my $i = 0; $i < @l; $i++) {
+            my $lo = $i == 0 ? $dsize : $l[$i - 1];
+            my $hi = $i + 1 < @l ? $l[$i + 1] : 1e30;
+            my $c = 0;
+            for my $s (@sizes) {
+                $c += $count{$s} if $s > $lo && $s <= $hi;
+            }
+            if ($best_count < 0 || $c < $best_count) {
+                $best = $i;
+                $best_count = $c;
+            }
+        }
+        splice(@l, $best, 1);
+    }
+    return @l;
+}
+
+# Classes with roughly equal numbers of allocations
+sub equal_count_limits {
+    my @big = grep { $_ > $dsize } @sizes;
+    my $n = 0;
+    $n += $count{$_} for @big;
+    my %l = ();
+    my $acc = 0;
+    my $next = 1;
+    for my $s (@big) {
+        $acc += $count{$s};
+        while ($next <= $ninner && $acc >= $n * $next / ($ninner + 1)) {
+            $l{$s} = 1;
+            $next++;
+        }
+    }
+    return normalize(%l);
+}
+
+# Give each of the most frequent sizes a class of its own
+sub peak_limits {
+    my ($npeaks) = @_;
+    my @byc = sort { $count{$b} <=> $count{$a} || $a <=> $b }
+        grep { $_ > $dsize } @sizes;
+    my %l = ();
+    for my $s (@byc[0 .. ($npeaks < @byc ? $npeaks : @byc) - 1]) {
+        $l{$s} = 1;
+        $l{$s - $dsize} = 1 if $s - $dsize > $dsize;
+    }
+    for my $p (pow2_limits()) {
+        $l{$p} = 1;
+    }
+    return normalize(%l);
+}
+
+# Map from block size (multiple of 16) to class, for a full table
+sub class_of {
+    my ($size, $limits) = @_;
+    for (my $k = 0; $k < @$limits; $k++) {
+        return $k if $size <= $limits->[$k];
+    }
+    return scalar(@$limits) - 1;
+}
+
+sub emit_header {
+    my ($file, $inner, $comment) = @_;
+    my @limits = ($dsize, @$inner, "SIZE_MAX");
+    open(my $fh, ">", $file) || die "Couldn't write '$file'\n";
+    print $fh "/*\n";
+    print $fh " * $file - seglist size classes for mm.c\n";
+    print $fh " *\n";
+    print $fh " * Generated by seglist-tune.pl. $comment\n" if $comment;
+    print $fh " * Block sizes up to seglist_lookup_max are mapped to a class by\n";
+    print $fh " * seglist_lookup[(size - 1) / 16]; larger sizes scan seglist_limit.\n";
+    print $fh " */\n\n";
+    print $fh "/** \@brief How many elements we want in the seglist **/\n";
+    print $fh "static const size_t seglist_length = $nclasses;\n\n";
+    print $fh "/** \@brief Largest block size held by each seglist class */\n";
+    print $fh wrap("static const size_t seglist_limit[] = {", \@limits, "};");
+    print $fh "\n";
+    print $fh "/** \@brief Largest block size covered by seglist_lookup */\n";
+    print $fh "static const size_t seglist_lookup_max = $lookup_max;\n\n";
+    print $fh "/** \@brief Seglist class of each block size up to the lookup max */\n";
+    my @cls = ();
+    my @numeric = ($dsize, @$inner, 1e30);
+    for (my $s = $dsize; $s <= $lookup_max; $s += $dsize) {
+        push(@cls, class_of($s, \@numeric));
+    }
+    print $fh wrap("static const unsigned char seglist_lookup[] = {", \@cls,
+                   "};");
+    close($fh);
+}
+
+# Format an initializer list the way clang-format would
+sub wrap {
+    my ($open, $items, $close) = @_;
+    my $one = $open . join(", ", @$items) . $close;
+    return "$one\n" if length($one) <= 80;
+    my $out = "$open\n";
+    my $line = "   ";
+    for (my $i = 0; $i < @$items; $i++) {
+        my $item = $items->[$i] . ($i + 1 < @$items ? "," : "");
+        if (length($line) + 1 + length($item) > 80) {
+            $out .= "$line\n";
+            $line = "   ";
+        }
+        $line .= " $item";
+    }
+    return "$out$line$close\n";
+}
+
+#
+# Replay the traces with a candidate table $runs times.  Utilization is
+# the same every run; throughput is the median.  Results are cached by
+# table.
+#
+%cache = ();
+$evals = 0;
+$base_tput = 0;
+@base_range = ();
+
+sub median {
+    my @s = sort { $a <=> $b } @_;
+    return @s % 2 ? $s[$#s / 2] : ($s[@s / 2 - 1] + $s[@s / 2]) / 2;
+}
+
+sub evaluate {
+    my (@inner) = @_;
+    my $key = join(",", @inner);
+    return $cache{$key} if defined($cache{$key});
+    return undef if $evals >= $max_evals;
+    $evals++;
+
+    emit_header($tune_header, \@inner, "");
+    system("$make mdriver-tune") == 0 || die "Couldn't build mdriver-tune\n";
+    my $args = join(" ", map { "-f '$_'" } @traces);
+    my $util = 0;
+    my $valid = 1;
+    my @tputs = ();
+    for (my $i = 0; $i < $runs && $valid; $i++) {
+        my $out = `$tune_driver -v 0 -B 1 $args 2>&1`;
+        $valid = $out !~ /Terminated with/ && $out =~ /Average utilization/;
+        if ($out =~ /Average utilization = ([\d.]+)%/) {
+            $util = $1 / 100.0;
+        }
+        if ($out =~ /Average throughput \(Kops\/sec\) = (\d+)/) {
+            push(@tputs, $1);
+        }
+    }
+    $valid = $valid && @tputs == $runs;
+    my $tput = $valid ? median(@tputs) : 0;
+    my @s = sort { $a <=> $b } @tputs;
+    if ($base_tput == 0 && $valid) {
+        # The first table replayed is the baseline
+        $base_tput = $tput;
+        @base_range = ($s[0], $s[-1]);
+    }
+    my $obj = -1;
+    if ($valid && $base_tput > 0) {
+        my $ratio = 1;
+        if ($s[0] > $base_range[1] || $s[-1] < $base_range[0]) {
+            $ratio = $tput / $base_tput;
+        }
+        $obj = $util_weight * $util + (1 - $util_weight) * $ratio;
+    }
+    $cache{$key} = [$obj, $util, $tput];
+    if ($verbose) {
+        printf "  [%d] obj %.4f util %.1f%% tput %d (%s): %s\n", $evals,
+            $obj, 100 * $util, $tput, join(" ", @tputs), $key;
+    }
+    return $cache{$key};
+}
+
+print "Searching class tables (up to $max_evals tables, $runs runs each)\n";
+
+my @base = pow2_limits();
+my $r = evaluate(@base);
+die "Baseline classes failed on these traces\n" if $r->[0] < 0;
+@best = @base;
+$best_r = $r;
+
+for my $cand ([equal_count_limits()],
+              [peak_limits(int($ninner / 2))],
+              [peak_limits($ninner)]) {
+    my $r = evaluate(@$cand);
+    if (defined($r) && $r->[0] > $best_r->[0]) {
+        @best = @$cand;
+        $best_r = $r;
+    }
+}
+
+# Local search: move one limit at a time to a neighboring candidate point
+my $improved = 1;
+while ($improved && $evals < $max_evals) {
+    $improved = 0;
+    for (my $j = 0; $j < $ninner && $evals < $max_evals; $j++) {
+        my $lo = $j == 0 ? $dsize : $best[$j - 1];
+        my $hi = $j + 1 < $ninner ? $best[$j + 1] : 1e30;
+        my ($pos) = grep { $points[$_] == $best[$j] } 0 .. $#points;
+        next unless defined($pos);
+        for my $np ($pos - 1, $pos + 1) {
+            next if $np < 0 || $np > $#points;
+            next if $points[$np] <= $lo || $points[$np] >= $hi;
+            my @cand = @best;
+            $cand[$j] = $points[$np];
+            my $r = evaluate(@cand);
+            if (defined($r) && $r->[0] > $best_r->[0]) {
+                @best = @cand;
+                $best_r = $r;
+                $improved = 1;
+                last;
+            }
+        }
+    }
+}
+
+my $b = $cache{join(",", @base)};
+printf "Baseline: util %.1f%%, %d Kops/s (runs from %d to %d)\n",
+    100 * $b->[1], $b->[2], @base_range;
+printf "Best:     util %.1f%%, %d Kops/s, objective %.4f after %d replays\n",
+    100 * $best_r->[1], $best_r->[2], $best_r->[0], $evals;
+printf "Limits:   %s\n", join(" ", $dsize, @best, "max");
+
+emit_header($outfile, \@best,
+            sprintf("Util %.1f%%, %d Kops/s\n * (baseline %.1f%%, %d Kops/s) on %s.\n *",
+                    100 * $best_r->[1], $best_r->[2], 100 * $b->[1], $b->[2],
+                    join(" ", @traces)));
+print "Wrote $outfile; build with \"make SEGLIST_CLASSES=$outfile\"\n";
@@ -0,0 +1,388 @@
+#!/usr/bin/perl
+use Getopt::Std;
+use POSIX qw(ceil);
+
+#
+# tracegen.pl - Generate a synthetic .rep trace from a parameter file
+#
+# A parameter file sets trace-wide values and then describes one or more
+# phases.  Blank lines and text after '#' are ignored:
+#
+#     weight = 1               # trace weight (default 1)
+#     seed = 42                # random seed (default 1)
+#     free_at_end = 1          # free the blocks live at the end (default 1)
+#     threads = 1              # threads making the requests (default 1)
+#     remote_free = 0          # probability a block is freed by a thread
+#                              # other than the one that allocated it
+#
+#     [phase]                  # starts a phase; phases run in order
+#     ops = 20000              # requests to generate in this phase
+#     size = powerlaw 16 4096 1.5
+#     lifetime = exponential 500
+#     realloc = 0.05 grow 2 65536
+#     free_previous = 0        # free blocks left by earlier phases first
+#
+# Sizes are in bytes and drawn from one of
+#
+#     fixed N                  always N
+#     uniform LO HI            uniform on [LO, HI]
+#     bimodal S1 S2 P          S1 with probability P, else S2
+#     powerlaw LO HI ALPHA     density proportional to size^-ALPHA on [LO, HI]
+#
+# Lifetimes count the requests between a block's allocation and its free:
+#
+#     fixed N                  exactly N
+#     exponential MEAN         exponentially distributed
+#     powerlaw LO HI ALPHA     as for sizes
+#     fifo N                   producer/consumer: a block is freed once N
+#                              newer blocks have been allocated
+#     lifo N                   stack: allocate N blocks, free them newest
+#                              first, repeat
+#     forever                  never freed (until free_at_end)
+#
+# With probability P a request reallocates a random live block instead of
+# allocating a new one.  The new size is
+#
+#     grow F [MAX]             old size * F, at most MAX
+#     add N [MAX]              old size + N, at most MAX
+#     random                   drawn from the phase's size distribution
+#
+# Phases keep the frees of blocks allocated by earlier phases scheduled,
+# so a phase change leaves the heap in the state the earlier phase made.
+# Blocks still in a fifo queue or lifo stack at the end of their phase
+# are freed after as many more allocations, of any phase, as they would
+# have waited for in their own.
+#
+# With more than one thread, every block is allocated by a random thread,
+# which also reallocates it, and each request is prefixed with its thread
+# (t0, t1, ...) for mdriver -M.
+#
+
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-hv] [-s SEED] [-o OUTFILE] PARAMFILE\n";
+    printf STDERR "Options:\n";
+    printf STDERR "   -h              Print this message\n";
+    printf STDERR "   -v              Verbose mode\n";
+    printf STDERR "   -s SEED         Random seed, overriding the parameter file\n";
+    printf STDERR "   -o OUTFILE      Output trace (default: PARAMFILE with .rep suffix)\n";
+    die "\n";
+}
+
+getopts('hvs:o:');
+
+if ($opt_h || @ARGV != 1) {
+    &usage($ARGV[0]);
+}
+
+$verbose = 0;
+if ($opt_v) {
+    $verbose = 1;
+}
+
+$paramfile = $ARGV[0];
+$outfile = $opt_o;
+if (!$outfile) {
+    ($outfile = $paramfile) =~ s/(\.[^.\/]*)?$/.rep/;
+}
+
+#
+# Parse the parameter file
+#
+%global = (weight => 1, seed => 1, free_at_end => 1, threads => 1,
+           remote_free => 0);
+@phases = ();
+$params = \%global;
+
+open(IN, "<", $paramfile) || die "Couldn't open parameter file '$paramfile'\n";
+while (<IN>) {
+    s/#.*//;
+    next if (/^\s*$/);
+    if (/^\s*\[phase\]\s*$/) {
+        push(@phases, {ops => 1000, size => "fixed 16",
+                       lifetime => "forever", realloc => "0",
+                       free_previous => 0, line => $.});
+        $params = $phases[-1];
+    } elsif (/^\s*(\w+)\s*=\s*(.*?)\s*$/) {
+        if (!exists($params->{$1})) {
+            die "$paramfile:$.: unknown parameter '$1'\n";
+        }
+        $params->{$1} = $2;
+    } else {
+        die "$paramfile:$.: can't parse '$_'\n";
+    }
+}
+close(IN);
+
+if (!@phases) {
+    die "$paramfile: no [phase] sections\n";
+}
+
+if ($global{threads} < 1) {
+    die "$paramfile: threads must be at least 1\n";
+}
+if ($global{remote_free} < 0 || $global{remote_free} > 1) {
+    die "$paramfile: remote_free must be between 0 and 1\n";
+}
+
+$seed = defined($opt_s) ? $opt_s : $global{seed};
+srand($seed);
+
+#
+# Distributions.  Each parser checks its spec and returns a closure that
+# draws one value.
+#
+sub powerlaw
+{
+    my ($lo, $hi, $alpha) = @_;
+    my $u = rand();
+    if (abs($alpha - 1) < 1e-9) {
+        return $lo * ($hi / $lo) ** $u;
+    }
+    my $e = 1 - $alpha;
+    return ($lo ** $e + $u * ($hi ** $e - $lo ** $e)) ** (1 / $e);
+}
+
+sub size_dist
+{
+    my ($spec, $where) = @_;
+    my ($kind, @a) = split(' ', $spec);
+    if ($kind eq "fixed" && @a == 1 && $a[0] >= 1) {
+        return sub { $a[0] };
+    } elsif ($kind eq "uniform" && @a == 2 && 1 <= $a[0] && $a[0] <= $a[1]) {
+        return sub { $a[0] + int(rand($a[1] - $a[0] + 1)) };
+    } elsif ($kind eq "bimodal" && @a == 3 && $a[0] >= 1 && $a[1] >= 1) {
+        return sub { rand() < $a[2] ? $a[0] : $a[1] };
+    } elsif ($kind eq "powerlaw" && @a == 3 && 1 <= $a[0] && $a[0] <= $a[1]) {
+        return sub { int(&powerlaw(@a) + 0.5) };
+    }
+    die "$where: bad size distribution '$spec'\n";
+}
+
+sub lifetime_dist
+{
+    my ($spec, $where) = @_;
+    my ($kind, @a) = split(' ', $spec);
+    if ($kind eq "fixed" && @a == 1 && $a[0] >= 1) {
+        return sub { $a[0] };
+    } elsif ($kind eq "exponential" && @a == 1 && $a[0] > 0) {
+        return sub { 1 + int(-$a[0] * log(1 - rand())) };
+    } elsif ($kind eq "powerlaw" && @a == 3 && 1 <= $a[0] && $a[0] <= $a[1]) {
+        return sub { int(&powerlaw(@a) + 0.5) };
+    } elsif (($kind eq "fifo" || $kind eq "lifo") && @a == 1 && $a[0] >= 1) {
+        return undef;           # handled by the queue or stack
+    } elsif ($kind eq "forever" && @a == 0) {
+        return sub { -1 };
+    }
+    die "$where: bad lifetime distribution '$spec'\n";
+}
+
+sub realloc_spec
+{
+    my ($spec, $sizes, $where) = @_;
+    my ($p, $kind, @a) = split(' ', $spec);
+    if ($p == 0 && !defined($kind)) {
+        return (0, undef);
+    } elsif ($p < 0 || $p > 1) {
+        die "$where: realloc probability must be between 0 and 1\n";
+    } elsif ($kind eq "grow" && (@a == 1 || @a == 2) && $a[0] > 0) {
+        my $max = $a[1] || ~0;
+        return ($p, sub { my $n = ceil($_[0] * $a[0]);
+                          $n < $max ? $n : $max });
+    } elsif ($kind eq "add" && (@a == 1 || @a == 2)) {
+        my $max = $a[1] || ~0;
+        return ($p, sub { my $n = $_[0] + $a[0];
+                          $n < 1 ? 1 : $n < $max ? $n : $max });
+    } elsif ($kind eq "random" && @a == 0) {
+        return ($p, sub { &$sizes() });
+    }
+    die "$where: bad realloc pattern '$spec'\n";
+}
+
+#
+# Free schedule: a binary min-heap of [due time, id]
+#
+@heap = ();
+
+sub heap_push
+{
+    my ($item) = @_;
+    my $i = scalar(@heap);
+    push(@heap, $item);
+    while ($i > 0) {
+        my $parent = int(($i - 1) / 2);
+        last if ($heap[$parent][0] <= $heap[$i][0]);
+        @heap[$parent, $i] = @heap[$i, $parent];
+        $i = $parent;
+    }
+}
+
+sub heap_pop
+{
+    my $top = $heap[0];
+    my $last = pop(@heap);
+    if (@heap) {
+        $heap[0] = $last;
+        my $i = 0;
+        while (1) {
+            my ($l, $r, $min) = (2 * $i + 1, 2 * $i + 2, $i);
+            $min = $l if ($l < @heap && $heap[$l][0] < $heap[$min][0]);
+            $min = $r if ($r < @heap && $heap[$r][0] < $heap[$min][0]);
+            last if ($min == $i);
+            @heap[$min, $i] = @heap[$i, $min];
+            $i = $min;
+        }
+    }
+    return $top;
+}
+
+#
+# Generate the requests
+#
+@ops = ();
+%live = ();             # id -> size
+@live_ids = ();         # live ids, for picking realloc victims
+%live_pos = ();         # id -> index in @live_ids
+%owner = ();            # id -> thread that allocated it
+$num_ids = 0;
+$cur_bytes = 0;
+$max_bytes = 0;
+@carried = ();          # [allocations due, id] left by fifo/lifo phases
+
+# Prefix for a request made by thread $t, empty for single-threaded traces
+sub thread_tag
+{
+    my ($t) = @_;
+    return $global{threads} > 1 ? "t$t " : "";
+}
+
+sub do_alloc
+{
+    my ($size) = @_;
+    my $id = $num_ids++;
+    my $t = $global{threads} > 1 ? int(rand($global{threads})) : 0;
+    $owner{$id} = $t;
+    push(@ops, &thread_tag($t) . "a $id $size");
+    $live{$id} = $size;
+    $live_pos{$id} = scalar(@live_ids);
+    push(@live_ids, $id);
+    $cur_bytes += $size;
+    $max_bytes = $cur_bytes if ($cur_bytes > $max_bytes);
+    return $id;
+}
+
+sub do_free
+{
+    my ($id) = @_;
+    return if (!exists($live{$id}));
+    my $t = delete($owner{$id});
+    if ($global{remote_free} > 0 && rand() < $global{remote_free}) {
+        $t = ($t + 1 + int(rand($global{threads} - 1))) % $global{threads};
+    }
+    push(@ops, &thread_tag($t) . "f $id");
+    $cur_bytes -= delete($live{$id});
+    my $pos = delete($live_pos{$id});
+    my $moved = pop(@live_ids);
+    if ($moved != $id) {
+        $live_ids[$pos] = $moved;
+        $live_pos{$moved} = $pos;
+    }
+}
+
+sub do_realloc
+{
+    my ($id, $size) = @_;
+    push(@ops, &thread_tag($owner{$id}) . "r $id $size");
+    $cur_bytes += $size - $live{$id};
+    $live{$id} = $size;
+    $max_bytes = $cur_bytes if ($cur_bytes > $max_bytes);
+}
+
+foreach $phase (@phases) {
+    my $where = "$paramfile:$phase->{line}";
+    my $sizes = &size_dist($phase->{size}, $where);
+    my $lifetimes = &lifetime_dist($phase->{lifetime}, $where);
+    my ($realloc_p, $resize) = &realloc_spec($phase->{realloc}, $sizes, $where);
+    my ($order, $depth) = split(' ', $phase->{lifetime});
+    my @queue = ();             # blocks of this phase for fifo and lifo
+    my $popping = 0;            # lifo: freeing the stack
+    my $start = scalar(@ops);
+    my $end = $start + $phase->{ops};
+
+    if ($phase->{free_previous}) {
+        foreach $id (sort { $a <=> $b } keys(%live)) {
+            last if (@ops >= $end);
+            &do_free($id);
+        }
+        @heap = grep { exists($live{$_->[1]}) } @heap;
+        @carried = grep { exists($live{$_->[1]}) } @carried;
+        my @items = @heap;
+        @heap = ();
+        &heap_push($_) foreach (@items);
+    }
+
+    while (@ops < $end) {
+        my $now = scalar(@ops);
+        if (@heap && $heap[0][0] <= $now) {
+            &do_free(&heap_pop()->[1]);
+        } elsif (@carried && $carried[0][0] <= $num_ids) {
+            &do_free(shift(@carried)->[1]);
+        } elsif ($order eq "fifo" && @queue > $depth) {
+            &do_free(shift(@queue));
+        } elsif ($order eq "lifo" && ($popping || @queue >= $depth)) {
+            &do_free(pop(@queue));
+            $popping = @queue > 0;
+        } elsif (@live_ids && rand() < $realloc_p) {
+            my $id = $live_ids[int(rand(@live_ids))];
+            &do_realloc($id, &$resize($live{$id}));
+        } else {
+            my $id = &do_alloc(&$sizes());
+            if (defined($lifetimes)) {
+                my $life = &$lifetimes();
+                &heap_push([$now + $life, $id]) if ($life > 0);
+            } else {
+                push(@queue, $id);
+            }
+        }
+    }
+
+    # Carry the queue over. The oldest fifo block needs depth - (n - 1)
+    # more allocations, the next one one more, and so on; a lifo stack is
+    # freed newest first once it would have filled up.
+    my $n = scalar(@queue);
+    my @left = ();
+    if ($order eq "fifo") {
+        for (my $k = 0; $k < $n; $k++) {
+            push(@left, [$num_ids + $depth - ($n - 1 - $k), $queue[$k]]);
+        }
+    } elsif ($order eq "lifo") {
+        my $due = $num_ids + ($popping ? 0 : $depth - $n);
+        push(@left, [$due, $_]) foreach (reverse(@queue));
+    }
+    @carried = sort { $a->[0] <=> $b->[0] } (@carried, @left);
+
+    if ($verbose) {
+        printf "phase at line %d: %d requests, %d blocks live, %d bytes\n",
+            $phase->{line}, @ops - $start, scalar(@live_ids), $cur_bytes;
+    }
+}
+
+if ($global{free_at_end}) {
+    foreach $id (sort { $a <=> $b } keys(%live)) {
+        &do_free($id);
+    }
+}
+
+open(OUT, ">", $outfile) || die "Couldn't write '$outfile'\n";
+printf OUT "%d\n%d\n%d\n%d\n", $global{weight}, $num_ids, scalar(@ops),
+    $max_bytes;
+foreach $op (@ops) {
+    print OUT "$op\n";
+}
+close(OUT);
+
+if ($verbose) {
+    printf "%s: %d requests, %d ids, max_alloc %d\n", $outfile,
+        scalar(@ops), $num_ids, $max_bytes;
+}